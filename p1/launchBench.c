@@ -0,0 +1,122 @@
+/**
+ * Measures how long it takes to launch and reap a trivial command, the way wsh used to (fork + execvp) and the way it
+ * does now (posix_spawnp). fork copies the parent's page tables, so its cost grows with the shell's memory; the ballast
+ * option grows this process first to show that.
+ *
+ * Usage: ./launchBench [-n launches] [-m ballast MB] [command]   (defaults: 1000 launches, no ballast, true)
+ * Prints: method,mean_us,p50_us,p99_us
+ */
+
+#define _GNU_SOURCE
+
+//CLib imports
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+extern char** environ;
+
+//Launch argv and wait for it, returns 0 if it couldn't be started
+int launchFork(char** argv){
+	int status;
+	pid_t pid = fork();
+	
+	if ( pid == -1 ) {
+		return 0;
+	} else if ( pid == 0 ) {
+		execvp(argv[0], argv);
+		_exit(127);
+	}
+	
+	waitpid(pid, &status, 0);
+	return WIFEXITED(status) && WEXITSTATUS(status) != 127;
+}
+
+int launchSpawn(char** argv){
+	int status;
+	pid_t pid;
+	
+	if ( posix_spawnp(&pid, argv[0], NULL, NULL, argv, environ) != 0 ) {
+		return 0;
+	}
+	
+	waitpid(pid, &status, 0);
+	return 1;
+}
+
+int compareTimes(const void* a, const void* b){
+	double difference = *(const double*) a - *(const double*) b;
+	
+	return (difference > 0) - (difference < 0);
+}
+
+int main(int argc, char** argv) {
+	char* methods[] = {"fork_exec", "posix_spawn"};
+	int (*launchers[])(char**) = {launchFork, launchSpawn};
+	char* command[] = {"true", NULL};
+	struct timespec start, end;
+	long ballast = 0;
+	int launches = 1000;
+	double* times;
+	double total;
+	char* memory;
+	int opt, i, j;
+	
+	while ( (opt = getopt(argc, argv, "n:m:")) != -1 ) {
+		if ( opt == 'n' ) {
+			launches = atoi(optarg);
+		} else if ( opt == 'm' ) {
+			ballast = atol(optarg);
+		} else {
+			launches = 0;
+		}
+	}
+	
+	if ( launches <= 0 || ballast < 0 ) {
+		printf("Usage: ./launchBench [-n launches] [-m ballast MB] [command]\n");
+		return 1;
+	}
+	
+	if ( optind < argc ) {
+		command[0] = argv[optind];
+	}
+	
+	//Touched so the pages are really mapped, like a shell's long lived heap
+	if ( ballast > 0 ) {
+		memory = (char*) malloc(ballast << 20);
+		if ( memory == NULL ) {
+			printf("Could not allocate the ballast\n");
+			return 1;
+		}
+		memset(memory, 1, ballast << 20);
+	}
+	
+	times = (double*) malloc(sizeof(double) * launches);
+	printf("method,mean_us,p50_us,p99_us\n");
+	
+	for(i = 0; i < 2; i++ ) {
+		total = 0;
+		
+		for(j = 0; j < launches; j++ ) {
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			
+			if ( !launchers[i](command) ) {
+				printf("Could not run %s\n", command[0]);
+				return 1;
+			}
+			
+			clock_gettime(CLOCK_MONOTONIC, &end);
+			times[j] = (end.tv_sec - start.tv_sec) * 1000000.0 + (end.tv_nsec - start.tv_nsec) / 1000.0;
+			total += times[j];
+		}
+		
+		qsort(times, launches, sizeof(double), compareTimes);
+		printf("%s,%.1f,%.1f,%.1f\n", methods[i], total / launches, times[launches / 2], times[(launches * 99) / 100]);
+	}
+	
+	return 0;
+}
@@ -5,12 +5,21 @@
  * By: Paul Gerlich
  */
 
+#define _GNU_SOURCE
+
 //CLib imports
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/signalfd.h>
+#include <poll.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <errno.h>
 
 /*
  * Object declarations
@@ -25,8 +34,8 @@ struct job {
 	//Internal id for tracking
 	int id;
 
-	//The string representing the command
-	char command[500];
+	//The string representing the command (allocated, any length)
+	char* command;
 	
 	//system process id
 	int pId;
@@ -34,6 +43,9 @@ struct job {
 	//For management in the stack LL structure
 	job* next;
 	job* prev;
+	
+	//Next running job in the same pid bucket
+	job* pidNext;
 };
 
 //job stack object for tracking current jobs
@@ -52,8 +64,89 @@ typedef struct {
 	
 	//Number of finished jobs
 	int finishedJobs;
+	
+	//Running jobs by id (byId[id], grown as ids go up) and by pid (hash buckets, a power of two of them)
+	job** byId;
+	int idCapacity;
+	job** byPid;
+	int pidBuckets;
+	
+	//SIGCHLD is blocked and read from this signalfd instead, so children are reaped as soon as we look
+	int childEvents;
 } jobStack;
 
+//Reads command lines from stdin itself, so the shell can tell when a whole line is waiting and otherwise sleep on
+//stdin and job events together
+typedef struct {
+	char* buffer;
+	size_t size;
+	
+	//Unread input is buffer[start, end), and buffer[start, scanned) holds no newline
+	size_t start;
+	size_t scanned;
+	size_t end;
+	
+	int eof;
+} lineReader;
+
+//Chunk of memory in a parse arena
+typedef struct arenaBlock arenaBlock;
+struct arenaBlock {
+	arenaBlock* next;
+	size_t size;
+	size_t used;
+	char data[];
+};
+
+//Bump allocator for everything parsed from one line, released in one go by arenaReset
+typedef struct {
+	arenaBlock* blocks;
+} arena;
+
+//One command of a pipeline: its argument vector and redirections
+typedef struct {
+	//Arguments ending in a null pointer, as execvp wants them
+	char** argv;
+	int argc;
+	
+	//Files for < and > (NULL when not redirected)
+	char* inputFile;
+	char* outputFile;
+} simpleCommand;
+
+//A parsed command line: one or more commands joined by pipes
+typedef struct {
+	simpleCommand* stages;
+	int stageCount;
+	int isBackgroundTask;
+	
+	//The line as typed (without the &), for the job list
+	char* text;
+} commandLine;
+
+//A cached PATH lookup: a command name and the absolute path it resolved to
+typedef struct pathEntry pathEntry;
+struct pathEntry {
+	char* name;
+	char* path;
+	
+	//Launches that used this entry (shown by hash)
+	int hits;
+	
+	//Next entry in the same bucket
+	pathEntry* next;
+};
+
+//Hash table of PATH lookups (the hash builtin). Only valid for the PATH it was filled under.
+typedef struct {
+	pathEntry** buckets;
+	int bucketCount;
+	int count;
+	
+	//Value of PATH when the entries were resolved
+	char* pathValue;
+} pathCache;
+
 /*
  * End object declarations
  */
@@ -61,25 +154,57 @@ typedef struct {
 //Function declarations
 void doMainTasks();
 
+void initJobs();
 void addJob(char* command, int pid);
-void updateJobs();
+job* findJobById(int id);
+job* findJobByPid(pid_t pid);
+void finishJob(job* finishedJob);
+void reapJobs(int notify);
+void clearFinishedJobs();
 void printJobStack();
+char* readCommandLine(lineReader* reader);
 
-void waitForProcess(char* command);
+void waitForProcess(simpleCommand* command);
 void waitForBackgroundTasks();
-void changeWorkingDirectory(char* command);
-int executePipeCommands(char* command);
-int executeCommand(char* command);
-int executePipeCommands(char* command);
-int executeNormalCommand(char* command, int isBackgroundTask, int redirectInput, int redirectOutput);
+void changeWorkingDirectory(simpleCommand* command);
+int executeCommand(commandLine* line);
+int executePipeCommands(commandLine* line);
+int executeNormalCommand(simpleCommand* command, int isBackgroundTask, char* text);
+void addRedirections(posix_spawn_file_actions_t* actions, simpleCommand* command);
+void reportSpawnFailure(simpleCommand* command, int error);
+void initSpawnAttributes(posix_spawnattr_t* attributes);
 
-char** convertCommandToArray(char* command);
-char* getInputLocation(char* commandArray);
-char* getOutputLocation(char* commandArray);
+int parseCommandLine(arena* lineArena, const char* text, commandLine* line);
+int isBuiltin(commandLine* line, const char* name);
+void* arenaAlloc(arena* a, size_t size);
+
+char* resolveCommand(const char* name);
+int spawnCommand(pid_t* pid, simpleCommand* command, posix_spawn_file_actions_t* actions, posix_spawnattr_t* attributes);
+void hashCommands(simpleCommand* command);
+void clearPathCache();
+void arenaReset(arena* a);
+void arenaFree(arena* a);
+
+//Initial slots in the job tables (both double as they fill)
+#define JOB_TABLE_SIZE 64
+
+//Bytes read from stdin at a time
+#define LINE_READ_SIZE 4096
+
+//glibc 2.35 can hand a spawned pipeline the terminal itself, before the command runs
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 35))
+#define SPAWN_TCSETPGRP
+#endif
+
+//Environment handed to spawned commands
+extern char** environ;
 
 //Single instance of the jobStack
 jobStack jobs;
 
+//Single instance of the PATH lookup cache
+pathCache commandPaths;
+
 int main(int argc, char** argv) {
 	int running = 1;
 
@@ -92,65 +217,143 @@ int main(int argc, char** argv) {
 //Main loop functions
 void doMainTasks(){
 	//Initialize jobStack
-	jobs.jobIndex = 1;
-	jobs.runningCount = 0;
-	jobs.finishedJobs = 0;
+	initJobs();
+	
+	//Pipelines get the terminal while they run, and taking it back from them would otherwise stop us
+	signal(SIGTTOU, SIG_IGN);
+
+	//The line read and everything parsed from it
+	lineReader reader = {NULL, 0, 0, 0, 0, 0};
+	char* in;
+	arena lineArena = {NULL};
+	commandLine line;
 
 	//Continue executing until the end of input
-	while ( !feof(stdin) ) {
+	while ( 1 ) {
 		//Wait for commands
 		printf("wdh: ");
 		fflush(stdout);	
 
-		//Read the command
-		char in[256];
-		fgets(in, 256, stdin);
-		in[strlen(in) - 1] = '\0';
+		//Read the command, however long it is (jobs that finish meanwhile are reaped straight away)
+		in = readCommandLine(&reader);
+		if ( in == NULL ) {
+			waitForBackgroundTasks();
+			break;
+		}
 		
-		//printf("COMMAND WAS: %s\n", in);
-		//printf("COMMAND LENGTH: %d\n", strlen(in));
+		//The previous line's commands are done with
+		arenaReset(&lineArena);
 
+		if ( !parseCommandLine(&lineArena, in, &line) || line.stageCount == 0 ) {
+			//Syntax errors were reported by the parser, and blank lines have nothing to run
+		}
+		
 		//Check for custom commands
-		if ( strcmp(in, "exit") == 0 ) {
+		else if ( isBuiltin(&line, "exit") ) {
 			waitForBackgroundTasks();
-			return;
-		} else if ( strstr(in, "cd") ) {
-			changeWorkingDirectory(in);
-		} else if ( strstr(in, "wait") ) {
-			waitForProcess(in);
+			break;
+		} else if ( isBuiltin(&line, "cd") ) {
+			changeWorkingDirectory(&line.stages[0]);
+		} else if ( isBuiltin(&line, "wait") ) {
+			waitForProcess(&line.stages[0]);
+		} else if ( isBuiltin(&line, "hash") ) {
+			hashCommands(&line.stages[0]);
 		} 
 		
 		//Execute normal commands
 		else {
-			//Returns null for foreground and invalid jobs, returns process id upon succesfully starting a background job
-			int pid = executeCommand(in);
-			
-			//Break for child thread (returns -1 for child thread)
-			if ( pid < 0 ){
-				break;
-			}
+			executeCommand(&line);
 		}
 		
-		//Clear finished jobs and replace them with new finished jobs
-		updateJobs();
+		//Show the jobs, then forget the finished ones
+		reapJobs(0);
 		printJobStack();	
+		clearFinishedJobs();
 	}
-
+	
+	free(reader.buffer);
+	arenaFree(&lineArena);
 }
 
 /*
  * Start JobStack management
  */
 
+//Set up the job table and start taking SIGCHLD through a signalfd
+void initJobs(){
+	sigset_t childSignal;
+	
+	jobs.jobIndex = 1;
+	jobs.runningCount = 0;
+	jobs.finishedJobs = 0;
+	
+	jobs.idCapacity = JOB_TABLE_SIZE;
+	jobs.byId = (job**) calloc(jobs.idCapacity, sizeof(job*));
+	jobs.pidBuckets = JOB_TABLE_SIZE;
+	jobs.byPid = (job**) calloc(jobs.pidBuckets, sizeof(job*));
+	
+	//Blocked, SIGCHLD stays pending for the signalfd. Spawned commands get an empty mask back (initSpawnAttributes).
+	sigemptyset(&childSignal);
+	sigaddset(&childSignal, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &childSignal, NULL);
+	
+	jobs.childEvents = signalfd(-1, &childSignal, SFD_NONBLOCK | SFD_CLOEXEC);
+	if ( jobs.childEvents < 0 ) {
+		perror("signalfd");
+		exit(1);
+	}
+}
+
+//Bucket in byPid for a process id
+job** pidBucket(pid_t pid){
+	return &jobs.byPid[(unsigned int) pid & (jobs.pidBuckets - 1)];
+}
+
 //create the job for tracking
 void addJob(char* command, int pid){
 	//Create our job -- Malloc so it's on the heap not stack
 	job* currentJob = (job*) malloc(sizeof(job));
+	job* cur;
+	job* next;
+	job** oldBuckets;
+	int oldBucketCount;
+	int i;
 	
 	currentJob->id = jobs.jobIndex;
 	
-	strcpy(currentJob->command, command);
+	currentJob->command = strdup(command);
 	currentJob->pId = pid;
+	currentJob->prev = NULL;
+	
+	//Make room for the id
+	if ( currentJob->id >= jobs.idCapacity ) {
+		jobs.byId = (job**) realloc(jobs.byId, sizeof(job*) * jobs.idCapacity * 2);
+		memset(jobs.byId + jobs.idCapacity, 0, sizeof(job*) * jobs.idCapacity);
+		jobs.idCapacity *= 2;
+	}
+	
+	//Keep about one running job per pid bucket
+	if ( jobs.runningCount >= jobs.pidBuckets ) {
+		oldBuckets = jobs.byPid;
+		oldBucketCount = jobs.pidBuckets;
+		
+		jobs.pidBuckets *= 2;
+		jobs.byPid = (job**) calloc(jobs.pidBuckets, sizeof(job*));
+		
+		for(i = 0; i < oldBucketCount; i++ ) {
+			for(cur = oldBuckets[i]; cur; cur = next ) {
+				next = cur->pidNext;
+				cur->pidNext = *pidBucket(cur->pId);
+				*pidBucket(cur->pId) = cur;
+			}
+		}
+		
+		free(oldBuckets);
+	}
+	
+	jobs.byId[currentJob->id] = currentJob;
+	currentJob->pidNext = *pidBucket(pid);
+	*pidBucket(pid) = currentJob;
 	
 	//Increment job counter
 	jobs.jobIndex++;
@@ -166,64 +369,106 @@ void addJob(char* command, int pid){
 	jobs.running = currentJob;
 }
 
-//Clear the old finished jobs, and add any new ones
-void updateJobs(){
-	//Clear the finished jobs
-	job* cur = jobs.finished;
-	job* next = cur;
+//Running job with this id, or NULL
+job* findJobById(int id){
+	if ( id <= 0 || id >= jobs.idCapacity ) {
+		return NULL;
+	}
 	
-	int i = 0;
-	for(i = 0; i < jobs.finishedJobs; i++ ) {
-		next = cur->next;
-		free(cur);
-		cur = next;
+	return jobs.byId[id];
+}
+
+//Running job with this process id, or NULL
+job* findJobByPid(pid_t pid){
+	job* cur;
+	
+	for(cur = *pidBucket(pid); cur; cur = cur->pidNext ) {
+		if ( cur->pId == pid ) {
+			return cur;
+		}
 	}
+	
+	return NULL;
+}
 
-	jobs.finishedJobs = 0;
+//Move a reaped job from the running jobs to the finished ones
+void finishJob(job* finishedJob){
+	job** link = pidBucket(finishedJob->pId);
 	
-	//Set the new finished jobs to nada
-	cur = jobs.running;
-		
-	int jobsRemoved = 0;
+	//Out of the tables
+	while ( *link != finishedJob ) {
+		link = &(*link)->pidNext;
+	}
+	*link = finishedJob->pidNext;
+	jobs.byId[finishedJob->id] = NULL;
 	
-	for(i = 0; i< jobs.runningCount; i++ ) {
-		//Check status
-		int status;
-		waitpid(cur->pId, &status, WNOHANG);
-		
-		//printf("Status [%d] is {%d}\n",i+1,status);
-		
-		//Move finished jobs to finished LL
-		if ( !status ) {
-			if ( cur->next ) {
-				cur->next->prev = cur->prev;		
-			}
-			
-			if ( cur->prev ) {
-				cur->prev->next = cur->next;	
-			}
-			
-			if ( jobs.finished ) {
-				cur->next = jobs.finished;
-				jobs.finished->prev = cur;
-			}
-			
-			jobs.finished = cur;
-			jobs.finishedJobs++;
-			
-			jobsRemoved++;
-		}
-		
-		cur = cur->next;
+	//Out of the running LL
+	if ( finishedJob->next ) {
+		finishedJob->next->prev = finishedJob->prev;
 	}
+	
+	if ( finishedJob->prev ) {
+		finishedJob->prev->next = finishedJob->next;
+	} else {
+		jobs.running = finishedJob->next;
+	}
+	
+	//Onto the finished LL
+	finishedJob->prev = NULL;
+	finishedJob->next = jobs.finished;
+	jobs.finished = finishedJob;
+	jobs.finishedJobs++;
 
 	//Update the # of jobs running and reset the index if necessary
-	jobs.runningCount -= jobsRemoved;
+	jobs.runningCount--;
 	if ( jobs.runningCount == 0 ) {
 		jobs.jobIndex = 1;
 	}
 }
 
+//Reap every background job that has exited. With notify the user, who is sitting at the prompt, is told straight away.
+void reapJobs(int notify){
+	struct signalfd_siginfo info;
+	job* finishedJob;
+	pid_t pid;
+	int status;
+	
+	//Several exits may have been merged into one signal, so the signals only say it's worth asking
+	while ( read(jobs.childEvents, &info, sizeof(info)) == sizeof(info) ) {
+	}
+	
+	//Foreground commands are always waited for before we get here, so every child left is a job
+	while ( (pid = waitpid(-1, &status, WNOHANG)) > 0 ) {
+		finishedJob = findJobByPid(pid);
+		if ( finishedJob == NULL ) {
+			continue;
+		}
+		
+		if ( notify ) {
+			printf("\n[%d] Done %s \nwdh: ", finishedJob->id, finishedJob->command);
+			fflush(stdout);
+		}
+		
+		finishJob(finishedJob);
+	}
+}
+
+//Forget the finished jobs once they have been shown
+void clearFinishedJobs(){
+	job* cur = jobs.finished;
+	job* next;
+	
+	while ( cur ) {
+		next = cur->next;
+		free(cur->command);
+		free(cur);
+		cur = next;
+	}
+	
+	jobs.finished = NULL;
+	jobs.finishedJobs = 0;
+}
+
 //Function for printing out the current jobs in the stack
 void printJobStack(){
 	job* cur = jobs.running;
@@ -255,10 +500,8 @@ void printJobStack(){
  /*
  * Command execution
  */
- void waitForProcess(char* command){
-	char** commandArray = convertCommandToArray(command);
-		
-	int id = atoi(commandArray[1]);
+ void waitForProcess(simpleCommand* command){
+	int id = command->argc > 1 ? atoi(command->argv[1]) : 0;
 	
 	//parameter was not a valid number
 	if ( !id ) {
@@ -266,48 +509,33 @@ void printJobStack(){
 		return;
 	}
 	
-	//Search jobs for this specified id
-	int i;
-	int found = 0;
-	job* cur = jobs.running;
-	for(i = 0; i < jobs.runningCount; i++ ) {
-		
-		//Wait if we find the process
-		if ( cur->id == id ) {
-			printf("Waiting for [%d]\n",id);
-			found = 1;
-			waitpid(cur->pId, NULL, 0);
-			break;
-		}
-	}
+	//Look the job up by its id
+	job* cur = findJobById(id);
 	
-	if ( !found ) {
+	if ( !cur ) {
 		printf("[%d] was not found.\n", id);
+		return;
 	}
 	
-	return;
+	printf("Waiting for [%d]\n",id);
+	waitpid(cur->pId, NULL, 0);
+	finishJob(cur);
  }
  
  //Before honoring exit request, complete background jobs
  void waitForBackgroundTasks(){
-	//First thing - Update the jobs that are done so there's less overhead here.
-	updateJobs();
-	
-	int i, status;
-	job* cur = jobs.running;
-	
 	//Now wait for each job to complete (in the opposite order in which they were received). Order doesn't matter, just wait.
-	for(i = 0; i < jobs.runningCount; i++ ) {
-		waitpid(cur->pId, &status, 0);
+	while ( jobs.running ) {
+		waitpid(jobs.running->pId, NULL, 0);
+		finishJob(jobs.running);
 	}
 	
+	clearFinishedJobs();
  }
 
 //Changes the working directory
-void changeWorkingDirectory(char* command){
-	char** commandArray = convertCommandToArray(command);
-	
-	int success = chdir(commandArray[1]);
+void changeWorkingDirectory(simpleCommand* command){
+	int success = command->argc > 1 ? chdir(command->argv[1]) : -1;
 	
 	//Graceful failure or ls on success
 	if ( success < 0 ) {
@@ -315,197 +543,223 @@ void changeWorkingDirectory(char* command){
 		return;
 	} else {
 		printf("Starting ls\n");
-		char* cmd = "ls";
-		executeNormalCommand(cmd, 0, 0, 0);
+		char* lsArgv[] = {"ls", NULL};
+		simpleCommand ls = {lsArgv, 1, NULL, NULL};
+		executeNormalCommand(&ls, 0, "ls");
 	}
 }
  
 //Executes the command in either the foreground or background
-int executeCommand(char* command){
-	//Determine if this is a background task or not
-	int isBackgroundTask = 0;
-	int redirectInput = 0;
-	int redirectOutput = 0;
-	
-	//Check for background task, update command
-	if ( command[strlen(command) - 1] == '&' ) {
-		isBackgroundTask = 1;
-		command[strlen(command) - 1] = '\0';
-	}
-	
+int executeCommand(commandLine* line){
 	//Determine if we have pipes and execute accordingly
-	if ( strchr(command, '|') != NULL )  {
+	if ( line->stageCount > 1 )  {
 		
 		//Don't handle background pipes
-		if ( isBackgroundTask ) {
+		if ( line->isBackgroundTask ) {
 			printf("Background pipes are not supported.\n");
 			return 0;
 		}
 		
-		//Don't handle pipes and redirects
-		if ( strchr(command, '<') != NULL || strchr(command, '>') != NULL ) {
-			printf("The use of pipes and redirects is not supported.\n");
-			return 0;
-		}
-		
-		return executePipeCommands(command);
+		return executePipeCommands(line);
 	} 
 	
-	//redirected input
-	if ( strchr(command, '<') != NULL ) {
-		redirectInput = 1;
-	}
-	
-	//redirected output
-	if ( strchr(command, '>')  != NULL  ) {
-		redirectOutput = 1;
-	}
-	
 	//Handle all other commands
-	return executeNormalCommand(command, isBackgroundTask, redirectInput, redirectOutput);
+	return executeNormalCommand(&line->stages[0], line->isBackgroundTask, line->text);
 }
 
-//Executes a normal command without pipes
-int executeNormalCommand(char* command, int isBackgroundTask, int redirectInput, int redirectOutput){
-	char* cmdCpy = (char*) malloc(sizeof(char) * strlen(command));
-	strcpy(cmdCpy, command);
-	char** commandArray = convertCommandToArray(command);
-	
-	pid_t pid;
-	int status;
-	pid = fork();
-	
-	//Child
-	if (pid == 0) {
-		FILE* input;
-		FILE* output;
-		
-		//Setup file for redirecting input
-		if ( redirectInput ) {
-			input = fopen(getInputLocation(cmdCpy), "r");
-			if ( input ) {
-				dup2(fileno(input), STDIN_FILENO);
-				fclose(input);
-			} else {
-				printf("Opening file for STDIN redirection failed.\n");
-				return -1;
-			}
-		}
-		
-		//Setup file for redirecting output
-		if ( redirectOutput ) {
-			output = fopen(getOutputLocation(cmdCpy), "w");
-			if ( output ) {
-				dup2(fileno(output), STDOUT_FILENO);
-				fclose(output);
-			} else {
-				printf("Opening file for STDOUT redirection failed.\n");
-				return -1;
-			}
-		}
-		
-		execvp(commandArray[0], commandArray);
-		return -1;
-	} 
+//Add a command's < and > redirections to its spawn file actions (after any pipe wiring, so they take precedence)
+void addRedirections(posix_spawn_file_actions_t* actions, simpleCommand* command){
+	if ( command->inputFile ) {
+		posix_spawn_file_actions_addopen(actions, STDIN_FILENO, command->inputFile, O_RDONLY, 0);
+	}
 	
-	//Parent (us)
-	else {
-		//We block for foreground, don't block for background
-	    if (!isBackgroundTask) {
-		   waitpid(pid, &status, 0);
-		   if ( status ) {
-			   printf("Something went wrong. Perhaps your command was invalid.\n");
-		   }
-		   return 0;
-	    } else {
-			addJob(cmdCpy, pid);
-			return pid;
-		}
+	if ( command->outputFile ) {
+		posix_spawn_file_actions_addopen(actions, STDOUT_FILENO, command->outputFile, O_WRONLY | O_CREAT | O_TRUNC, 0666);
 	}
 }
 
-//Execute piped commands
-int executePipeCommands(char* command){
-	char* cmdCpy = (char*) malloc(sizeof(char) * strlen(command));
-	strcpy(cmdCpy, command);
+//Spawn attributes every command needs: our blocked SIGCHLD and ignored SIGTTOU must not carry over into it
+void initSpawnAttributes(posix_spawnattr_t* attributes){
+	sigset_t signals;
 	
-	int pipeCount = 0;
+	posix_spawnattr_init(attributes);
 	
-	char* cur = strtok(command, "|");
+	sigemptyset(&signals);
+	posix_spawnattr_setsigmask(attributes, &signals);
 	
-	//Count the pipes
-	while ( cur ) {
-		pipeCount++;
-		cur = strtok(NULL, "|");
-	}
+	sigaddset(&signals, SIGTTOU);
+	posix_spawnattr_setsigdefault(attributes, &signals);
 	
-	//printf("Number of pipe commands [%d]\n", pipeCount);
+	posix_spawnattr_setflags(attributes, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+}
+
+//Report a command that couldn't be spawned (error is what posix_spawn returned)
+void reportSpawnFailure(simpleCommand* command, int error){
+	if ( command->inputFile && access(command->inputFile, R_OK) < 0 ) {
+		printf("Opening file for STDIN redirection failed.\n");
+	} else if ( error == ENOENT ) {
+		printf("%s: command not found\n", command->argv[0]);
+	} else {
+		printf("%s: %s\n", command->argv[0], strerror(error));
+	}
+}
+
+//Executes a normal command without pipes. The process is started with posix_spawn, so the shell's memory is never
+//copied for it, and redirections are set up as spawn file actions instead of in a forked copy of the shell.
+int executeNormalCommand(simpleCommand* command, int isBackgroundTask, char* text){
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attributes;
+	pid_t pid;
+	int status;
+	int error;
 	
-	//Make an array for each command in the pipeline
-	char** pipeArray = (char**) malloc(sizeof(char*) * (pipeCount + 1));
+	posix_spawn_file_actions_init(&actions);
+	addRedirections(&actions, command);
+	initSpawnAttributes(&attributes);
 	
-	//Copy our array back over
-	strcpy(command, cmdCpy);
+	error = spawnCommand(&pid, command, &actions, &attributes);
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attributes);
 	
-	//Now add each pipe command to the array of commands
-	cur = strtok(command, "|");
-	int pipeArrayIndex = 0;
+	//Nothing was started: not on PATH, a redirection couldn't be opened or the command couldn't be run
+	if ( error ) {
+		reportSpawnFailure(command, error);
+		return 0;
+	}
 	
-	//Copy the pipes
-	while ( cur ) {
-		pipeArray[pipeArrayIndex] = (char*) malloc(sizeof(char) * strlen(cur));
-		strcpy(pipeArray[pipeArrayIndex], cur);
-		//printf("Read pipe cmd: {%s}\n", cur);
-		cur = strtok(NULL, "|");
-		pipeArrayIndex++;
+	//We block for foreground, don't block for background
+	if (!isBackgroundTask) {
+		waitpid(pid, &status, 0);
+		if ( status ) {
+			printf("Something went wrong. Perhaps your command was invalid.\n");
+		}
+		return 0;
+	} else {
+		addJob(text, pid);
+		return pid;
 	}
+}
+
+//Execute piped commands. Every stage is spawned up front in one process group, connected by pipes, and the whole
+//pipeline is reaped together once the last stage is done, so the stages stream into each other concurrently. The pipe
+//wiring and group are spawn file actions and attributes, so the shell is never forked.
+int executePipeCommands(commandLine* line){
+	int pipeCount = line->stageCount;
+	pid_t* pids = (pid_t*) malloc(sizeof(pid_t) * pipeCount);
 	
 	//Setup pipe variables for tracking
 	int fd[2];
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attributes;
+	short flags;
 	pid_t pid;
+	pid_t pgid = 0;
+	pid_t lastPid = 0; //The final stage, whose status is the pipeline's (0 if it never started)
+	int error;
 	int fd_in = STDIN_FILENO;
+	int started = 0;
+	int status = 0;
+	int lastStatus = 0;
+	int interactive = isatty(STDIN_FILENO);
 	
 	int i;
 	for(i = 0; i < pipeCount; i++ ) {
-		//Convert the command to what's needed
-		char** commandArray = convertCommandToArray(pipeArray[i]);
+		simpleCommand* command = &line->stages[i];
 		
-		pipe(fd);
+		//Every stage but the last writes into a new pipe. Both ends are close-on-exec, so only the dup2'd copies reach a stage.
+		fd[0] = -1;
+		fd[1] = STDOUT_FILENO;
+		if ( i != (pipeCount - 1) && pipe2(fd, O_CLOEXEC) < 0 ) {
+			perror("pipe");
+			break;
+		}
 		
-		//Failure
-		if ( (pid = fork()) == -1 ) {
-				perror("fork");
-				exit(1);
-		} else if( pid == 0 ) {
-			dup2(fd_in, STDIN_FILENO);
-			
-			//Passing along 
-			if ( i != (pipeCount - 1) ) {
-				dup2(fd[1], STDOUT_FILENO);
-			}
-			
-			//Close in
-			close(fd[0]);
-				
-			execvp(commandArray[0], commandArray);
-			
-			//Cancel out of child process
-			exit(0);
-			
+		posix_spawn_file_actions_init(&actions);
+		initSpawnAttributes(&attributes);
+		
+		//File actions run in order, so take the terminal while stdin still is one
+#ifdef SPAWN_TCSETPGRP
+		if ( interactive ) {
+			posix_spawn_file_actions_addtcsetpgrp_np(&actions, STDIN_FILENO);
+		}
+#endif
+		
+		if ( fd_in != STDIN_FILENO ) {
+			posix_spawn_file_actions_adddup2(&actions, fd_in, STDIN_FILENO);
+		}
+		
+		//Passing along 
+		if ( fd[0] >= 0 ) {
+			posix_spawn_file_actions_adddup2(&actions, fd[1], STDOUT_FILENO);
+		}
+		
+		addRedirections(&actions, command);
+		
+		//Join the pipeline's group (the first stage leads it), which is the terminal's foreground group
+		posix_spawnattr_setpgroup(&attributes, pgid);
+		posix_spawnattr_getflags(&attributes, &flags);
+		posix_spawnattr_setflags(&attributes, flags | POSIX_SPAWN_SETPGROUP);
+		
+		error = spawnCommand(&pid, command, &actions, &attributes);
+		posix_spawn_file_actions_destroy(&actions);
+		posix_spawnattr_destroy(&attributes);
+		
+		if ( error ) {
+			//Reported for this stage alone: the stages around it still run, the next one just sees end of file
+			reportSpawnFailure(command, error);
 		} else {
-			//Wait for prev to finish
-			wait(NULL);
+			if ( i == pipeCount - 1 ) {
+				lastPid = pid;
+			}
 			
-			//Close out
+			//Set the group from our side too so it exists before the next stage joins it
+			if ( pgid == 0 ) {
+				pgid = pid;
+			}
+			setpgid(pid, pgid);
+			if ( interactive ) {
+				tcsetpgrp(STDIN_FILENO, pgid);
+			}
+			pids[started++] = pid;
+		}
+		
+		//Our copies of the pipe ends now belong to the children
+		if ( fd_in != STDIN_FILENO ) {
+			close(fd_in);
+		}
+		
+		if ( fd[0] >= 0 ) {
 			close(fd[1]);
-			
-			//Save the input
-			fd_in = fd[0];
-			
-			//printf("Will now read from: %d\n", fd_in);
 		}
+		
+		//Save the input
+		fd_in = fd[0];
+	}
+	
+	//A pipe couldn't be made part way, so nothing reads the last one
+	if ( fd_in >= 0 && fd_in != STDIN_FILENO ) {
+		close(fd_in);
 	}
 	
+	//Reap the whole pipeline, its exit status is the last stage's
+	for(i = 0; i < started; i++ ) {
+		waitpid(pids[i], &status, 0);
+		if ( pids[i] == lastPid ) {
+			lastStatus = status;
+		}
+	}
+	
+	if ( interactive ) {
+		tcsetpgrp(STDIN_FILENO, getpgrp());
+	}
+	
+	//Stages that didn't start have been reported already
+	if ( lastStatus ) {
+		printf("Something went wrong. Perhaps your command was invalid.\n");
+	}
+	
+	free(pids);
+	
 	return 0;
 }
  
@@ -514,106 +768,603 @@ int executePipeCommands(char* command){
  */
  
  /*
-  * Misc functions
-  */ 
+  * Line input
+  */
+
+//Next command line from stdin without its newline, or NULL at the end of input. While no whole line is waiting we sleep
+//in poll on stdin and the job events together, so background jobs are reaped (and reported) the moment they exit. The
+//line stays valid until the next call.
+char* readCommandLine(lineReader* reader){
+	struct pollfd events[2];
+	char* newline;
+	char* line;
+	ssize_t count;
+	
+	while ( 1 ) {
+		//Only the part not yet looked at is searched, so long lines are scanned once
+		newline = reader->end > reader->scanned ? (char*) memchr(reader->buffer + reader->scanned, '\n', reader->end - reader->scanned) : NULL;
+		if ( newline ) {
+			*newline = '\0';
+			line = reader->buffer + reader->start;
+			reader->start = reader->scanned = (newline - reader->buffer) + 1;
+			return line;
+		}
+		reader->scanned = reader->end;
+		
+		//A last line without a newline still counts
+		if ( reader->eof ) {
+			if ( reader->start == reader->end ) {
+				return NULL;
+			}
+			
+			reader->buffer[reader->end] = '\0';
+			line = reader->buffer + reader->start;
+			reader->start = reader->scanned = reader->end;
+			return line;
+		}
+		
+		//Move the partial line to the front, then make sure there's room to read more (and for a terminator)
+		if ( reader->start > 0 ) {
+			memmove(reader->buffer, reader->buffer + reader->start, reader->end - reader->start);
+			reader->end -= reader->start;
+			reader->scanned -= reader->start;
+			reader->start = 0;
+		}
+		
+		if ( reader->size - reader->end < LINE_READ_SIZE ) {
+			reader->size = reader->size ? reader->size * 2 : LINE_READ_SIZE * 2;
+			reader->buffer = (char*) realloc(reader->buffer, reader->size);
+		}
+		
+		events[0].fd = STDIN_FILENO;
+		events[0].events = POLLIN;
+		events[1].fd = jobs.childEvents;
+		events[1].events = POLLIN;
+		
+		if ( poll(events, 2, -1) < 0 ) {
+			continue;
+		}
+		
+		//Someone at a terminal hears about it now, a script sees it in the next job list
+		if ( events[1].revents & POLLIN ) {
+			reapJobs(isatty(STDIN_FILENO));
+		}
+		
+		if ( events[0].revents & (POLLIN | POLLHUP | POLLERR) ) {
+			count = read(STDIN_FILENO, reader->buffer + reader->end, reader->size - reader->end - 1);
+			if ( count <= 0 ) {
+				reader->eof = 1;
+			} else {
+				reader->end += count;
+			}
+		}
+	}
+}
+
+ /*
+  * End line input
+  */
+ 
+ /*
+  * Command parsing
+  *
+  * A line is read in one pass by nextToken and parseCommandLine, straight into a commandLine whose strings and arrays all
+  * live in the line's arena. Words are separated by blanks and by the operators | < > &; inside single quotes
+  * everything is literal, inside double quotes a backslash escapes " and \, and elsewhere a backslash escapes any character.
+  */
  
-//Given a command of the form 'cmd arg1 arg2 ...' it returns the array {cmd, arg1, arg2, ...}
-char** convertCommandToArray(char* command){
+//Tokens read by nextToken
+enum { TOKEN_END, TOKEN_WORD, TOKEN_PIPE, TOKEN_INPUT, TOKEN_OUTPUT, TOKEN_BACKGROUND, TOKEN_UNTERMINATED };
+
+//Tokenizer position in a line
+typedef struct {
+	//Next character to read
+	const char* at;
 	
-	//Count the spaces -- there are N+2 arguments (including the null pointer)
-	int i;
-	int count = 0;
-	for( i = 0; i < strlen(command); i++ ) {
-		char c = command[i];
-		if ( c == ' ' ) {
-			count++;
+	//Where the next word's characters go, and the last word read
+	char* out;
+	char* word;
+} lexer;
+
+//A word in a stage that is still being parsed
+typedef struct wordList wordList;
+struct wordList {
+	char* word;
+	wordList* next;
+};
+
+//A stage that is still being parsed. Its words are kept in a list until the count is known.
+typedef struct parsedStage parsedStage;
+struct parsedStage {
+	simpleCommand command;
+	wordList* words;
+	wordList** lastWord;
+	parsedStage* next;
+};
+
+//Blocks an arena grows by (larger requests get a block of their own)
+#define ARENA_BLOCK_SIZE 4096
+
+//Read the next token. Words are unquoted into lex->out and left in lex->word.
+int nextToken(lexer* lex){
+	//Skip blanks
+	while ( *lex->at == ' ' || *lex->at == '\t' ) {
+		lex->at++;
+	}
+	
+	switch ( *lex->at ) {
+		case '\0':
+			return TOKEN_END;
+		case '|':
+			lex->at++;
+			return TOKEN_PIPE;
+		case '<':
+			lex->at++;
+			return TOKEN_INPUT;
+		case '>':
+			lex->at++;
+			return TOKEN_OUTPUT;
+		case '&':
+			lex->at++;
+			return TOKEN_BACKGROUND;
+	}
+	
+	//A word runs until an unquoted blank or operator
+	lex->word = lex->out;
+	
+	while ( *lex->at != '\0' && strchr(" \t|<>&", *lex->at) == NULL ) {
+		if ( *lex->at == '\'' ) {
+			lex->at++;
+			while ( *lex->at != '\0' && *lex->at != '\'' ) {
+				*lex->out++ = *lex->at++;
+			}
+			
+			if ( *lex->at == '\0' ) {
+				return TOKEN_UNTERMINATED;
+			}
+			lex->at++;
+		} else if ( *lex->at == '"' ) {
+			lex->at++;
+			while ( *lex->at != '\0' && *lex->at != '"' ) {
+				if ( *lex->at == '\\' && (lex->at[1] == '"' || lex->at[1] == '\\') ) {
+					lex->at++;
+				}
+				*lex->out++ = *lex->at++;
+			}
+			
+			if ( *lex->at == '\0' ) {
+				return TOKEN_UNTERMINATED;
+			}
+			lex->at++;
+		} else {
+			if ( *lex->at == '\\' && lex->at[1] != '\0' ) {
+				lex->at++;
+			}
+			*lex->out++ = *lex->at++;
 		}
 	}
 	
-	count+= 2;
-		
-	//Now create our result array and fill it with these damn arguments
-	char** resultArray = (char**) malloc(sizeof(char*) * count);
+	*lex->out++ = '\0';
+	
+	return TOKEN_WORD;
+}
+
+//Parse a line into pipeline stages, their arguments and redirections. Returns 0 (after saying why) on a syntax error.
+int parseCommandLine(arena* lineArena, const char* text, commandLine* line){
+	size_t length = strlen(text);
+	parsedStage* stages = NULL;
+	parsedStage** lastStage = &stages;
+	parsedStage* stage = NULL;
+	wordList* word;
+	lexer lex;
+	int token;
+	int i;
+	
+	//Every word takes at least one character of the line and adds one terminator, so this holds all of them
+	lex.at = text;
+	lex.out = (char*) arenaAlloc(lineArena, 2 * length + 2);
 	
-	int resultIndex = 0;
+	line->stages = NULL;
+	line->stageCount = 0;
+	line->isBackgroundTask = 0;
+	line->text = (char*) arenaAlloc(lineArena, length + 1);
+	strcpy(line->text, text);
 	
-	//If the command has any spaces (i.e, more than one argument)
-	if ( count > 2 ) {
-		char* arg = strtok(command, " ");
+	while ( (token = nextToken(&lex)) != TOKEN_END ) {
+		//& has to end the line
+		if ( line->isBackgroundTask ) {
+			printf("Invalid syntax: & must come last.\n");
+			return 0;
+		}
+		
+		//Words and redirections go to the current stage, which starts with the first of them
+		if ( stage == NULL && (token == TOKEN_WORD || token == TOKEN_INPUT || token == TOKEN_OUTPUT) ) {
+			stage = (parsedStage*) arenaAlloc(lineArena, sizeof(parsedStage));
+			memset(stage, 0, sizeof(parsedStage));
+			stage->lastWord = &stage->words;
+			
+			*lastStage = stage;
+			lastStage = &stage->next;
+			line->stageCount++;
+		}
 		
-		while ( arg ) { 
-			//Skipping redirection stuff
-			if ( strchr(arg, '<') != NULL || strchr(arg, '>') != NULL) {
-				//Skip this element (the Redirect character)
-				arg = strtok(NULL, " ");
+		switch ( token ) {
+			case TOKEN_UNTERMINATED:
+				printf("Invalid syntax: unterminated quote.\n");
+				return 0;
 				
-				//Skip next element) (the redirect file)
-				arg = strtok(NULL, " ");
-			} else {
-				//Copy as usual
-				resultArray[resultIndex] = (char*) malloc(sizeof(char) * strlen(arg));
-				strcpy(resultArray[resultIndex], arg);
-				resultIndex++;
+			case TOKEN_WORD:
+				word = (wordList*) arenaAlloc(lineArena, sizeof(wordList));
+				word->word = lex.word;
+				word->next = NULL;
+				*stage->lastWord = word;
+				stage->lastWord = &word->next;
+				stage->command.argc++;
+				break;
+				
+			case TOKEN_INPUT:
+			case TOKEN_OUTPUT:
+				if ( nextToken(&lex) != TOKEN_WORD ) {
+					printf("Invalid syntax: expected a file after %c.\n", token == TOKEN_INPUT ? '<' : '>');
+					return 0;
+				}
+				
+				if ( token == TOKEN_INPUT ) {
+					stage->command.inputFile = lex.word;
+				} else {
+					stage->command.outputFile = lex.word;
+				}
+				break;
+				
+			case TOKEN_PIPE:
+				if ( stage == NULL || stage->command.argc == 0 ) {
+					printf("Invalid pipe syntax.\n");
+					return 0;
+				}
+				stage = NULL;
+				break;
 				
-				arg = strtok(NULL, " ");
+			case TOKEN_BACKGROUND:
+				line->isBackgroundTask = 1;
 				
+				//The job list shows the line without it
+				line->text[(lex.at - 1) - text] = '\0';
+				break;
+		}
+	}
+	
+	//A trailing | or a stage of nothing but redirections has no command to run
+	if ( line->stageCount > 0 && (stage == NULL || stage->command.argc == 0) ) {
+		printf("Invalid pipe syntax.\n");
+		return 0;
+	}
+	
+	if ( line->isBackgroundTask && line->stageCount == 0 ) {
+		printf("Invalid syntax: & must follow a command.\n");
+		return 0;
+	}
+	
+	//Now the counts are known, lay the stages and their arguments out as arrays
+	line->stages = (simpleCommand*) arenaAlloc(lineArena, sizeof(simpleCommand) * line->stageCount);
+	
+	for(stage = stages, i = 0; stage; stage = stage->next, i++ ) {
+		line->stages[i] = stage->command;
+		line->stages[i].argv = (char**) arenaAlloc(lineArena, sizeof(char*) * (stage->command.argc + 1));
+		
+		int argIndex = 0;
+		for(word = stage->words; word; word = word->next ) {
+			line->stages[i].argv[argIndex++] = word->word;
+		}
+		
+		//execvp needs the list ended by a null pointer
+		line->stages[i].argv[argIndex] = NULL;
+	}
+	
+	return 1;
+}
+
+//If the line is a single command named name (builtins don't take part in pipelines)
+int isBuiltin(commandLine* line, const char* name){
+	return line->stageCount == 1 && strcmp(line->stages[0].argv[0], name) == 0;
+}
+
+//Allocate from the arena. The memory lives until the next arenaReset.
+void* arenaAlloc(arena* a, size_t size){
+	arenaBlock* block = a->blocks;
+	
+	//Keep every allocation aligned for the pointers stored in it
+	size = (size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+	
+	if ( block == NULL || block->size - block->used < size ) {
+		size_t blockSize = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+		
+		block = (arenaBlock*) malloc(sizeof(arenaBlock) + blockSize);
+		if ( block == NULL ) {
+			perror("malloc");
+			exit(1);
+		}
+		
+		block->size = blockSize;
+		block->used = 0;
+		block->next = a->blocks;
+		a->blocks = block;
+	}
+	
+	void* result = block->data + block->used;
+	block->used += size;
+	
+	return result;
+}
+
+//Release everything allocated from the arena, keeping its first block for reuse
+void arenaReset(arena* a){
+	arenaBlock* block = a->blocks;
+	arenaBlock* next;
+	
+	if ( block == NULL ) {
+		return;
+	}
+	
+	while ( block->next ) {
+		next = block->next;
+		free(block);
+		block = next;
+	}
+	
+	block->used = 0;
+	a->blocks = block;
+}
+
+//Release the arena entirely
+void arenaFree(arena* a){
+	arenaReset(a);
+	free(a->blocks);
+	a->blocks = NULL;
+}
+
+ /*
+  * End command parsing
+  */
+ 
+ /*
+  * Command lookup
+  *
+  * Commands are launched by absolute path. resolveCommand walks PATH once per command name and keeps the answer in
+  * commandPaths, so later launches cost just a hash lookup instead of a failed execve for every directory ahead of it.
+  * Hits are trusted as they are: only when spawning one fails because the file is gone or no longer runnable is the
+  * entry dropped and PATH walked again. The cache starts over whenever PATH changes. Names found through a
+  * relative PATH entry (like .) depend on the working directory, so those are looked up every time.
+  */
+
+//Buckets a new cache starts with (always a power of two, doubled when the entries outnumber them)
+#define PATH_CACHE_BUCKETS 64
+
+//FNV-1a hash of a command name
+unsigned int hashName(const char* name){
+	unsigned int hash = 2166136261u;
+	
+	while ( *name ) {
+		hash = (hash ^ (unsigned char) *name++) * 16777619u;
+	}
+	
+	return hash;
+}
+
+//Entry for name, or NULL
+pathEntry* findPathEntry(const char* name){
+	pathEntry* entry;
+	
+	if ( commandPaths.buckets == NULL ) {
+		return NULL;
+	}
+	
+	for(entry = commandPaths.buckets[hashName(name) & (commandPaths.bucketCount - 1)]; entry; entry = entry->next ) {
+		if ( strcmp(entry->name, name) == 0 ) {
+			return entry;
+		}
+	}
+	
+	return NULL;
+}
+
+//Add an entry, growing the table when it gets full
+pathEntry* addPathEntry(const char* name, const char* path){
+	pathEntry* entry;
+	pathEntry* next;
+	pathEntry** buckets;
+	int bucketCount;
+	int i;
+	
+	if ( commandPaths.count >= commandPaths.bucketCount ) {
+		bucketCount = commandPaths.bucketCount ? commandPaths.bucketCount * 2 : PATH_CACHE_BUCKETS;
+		buckets = (pathEntry**) calloc(bucketCount, sizeof(pathEntry*));
+		
+		//Move the existing entries over
+		for(i = 0; i < commandPaths.bucketCount; i++ ) {
+			for(entry = commandPaths.buckets[i]; entry; entry = next ) {
+				next = entry->next;
+				entry->next = buckets[hashName(entry->name) & (bucketCount - 1)];
+				buckets[hashName(entry->name) & (bucketCount - 1)] = entry;
 			}
 		}
-	} else {
-		resultArray[0] = (char*) malloc(sizeof(char) * strlen(command));
-		strcpy(resultArray[0], command);
-		resultIndex++;
+		
+		free(commandPaths.buckets);
+		commandPaths.buckets = buckets;
+		commandPaths.bucketCount = bucketCount;
 	}
 	
-	//for( i = 0; i <= resultIndex; i++ ) {
-	//	printf("%d -- %s\n", i, resultArray[i]);
-	//}
+	entry = (pathEntry*) malloc(sizeof(pathEntry));
+	entry->name = strdup(name);
+	entry->path = strdup(path);
+	entry->hits = 0;
+	entry->next = commandPaths.buckets[hashName(name) & (commandPaths.bucketCount - 1)];
+	commandPaths.buckets[hashName(name) & (commandPaths.bucketCount - 1)] = entry;
+	commandPaths.count++;
 	
-	return resultArray;
+	return entry;
 }
 
-//Gets the input file for a redirect
-char* getInputLocation(char* command){
-	//Make our copy
-	char* cpy = (char*) malloc(sizeof(char) * strlen(command));
-	strcpy(cpy, command);
+//Drop an entry whose file has gone away
+void removePathEntry(pathEntry* removed){
+	pathEntry** link = &commandPaths.buckets[hashName(removed->name) & (commandPaths.bucketCount - 1)];
+	
+	while ( *link != removed ) {
+		link = &(*link)->next;
+	}
+	
+	*link = removed->next;
+	commandPaths.count--;
+	
+	free(removed->name);
+	free(removed->path);
+	free(removed);
+}
 
-	char* arg = strtok(cpy, " ");
+//Forget every lookup (hash -r, or PATH changed)
+void clearPathCache(){
+	pathEntry* entry;
+	pathEntry* next;
+	int i;
 	
-	//Go through and find the input file
-	while ( arg ) {
-		if( strchr(arg, '<') != NULL ) {
-			arg = strtok(NULL, " ");
-			break;
+	for(i = 0; i < commandPaths.bucketCount; i++ ) {
+		for(entry = commandPaths.buckets[i]; entry; entry = next ) {
+			next = entry->next;
+			free(entry->name);
+			free(entry->path);
+			free(entry);
 		}
-		arg = strtok(NULL, " ");
+		
+		commandPaths.buckets[i] = NULL;
 	}
 	
-	return arg;
+	commandPaths.count = 0;
+}
+
+//If path is a file we could run, by its mode bits (one stat per directory tried; posix_spawn has the final say)
+int isExecutable(const char* path){
+	struct stat info;
+	
+	return stat(path, &info) == 0 && S_ISREG(info.st_mode) && (info.st_mode & (S_IXUSR | S_IXGRP | S_IXOTH)) != 0;
 }
 
-//Gets the output file for a redirect
-char* getOutputLocation(char* command){
-	//Make our copy
-	char* cpy = (char*) malloc(sizeof(char) * strlen(command));
-	strcpy(cpy, command);
+//Absolute (or, for names containing a /, given) path to run name by, or NULL if it isn't on PATH
+char* resolveCommand(const char* name){
+	static char* uncached = NULL;
+	char* pathValue = getenv("PATH");
+	pathEntry* entry;
+	char* dir;
+	char* end;
+	size_t dirLength;
 	
-	char* arg = strtok(cpy, " ");
+	//Paths are run as given
+	if ( strchr(name, '/') != NULL ) {
+		return (char*) name;
+	}
 	
-	//Go through and find the input file
-	while ( arg ) {
-		if( strchr(arg, '>') != NULL ) {
-			arg = strtok(NULL, " ");
-			break;
+	//Same default search path execvp uses
+	if ( pathValue == NULL ) {
+		pathValue = "/bin:/usr/bin";
+	}
+	
+	//The cache only holds for the PATH it was filled under
+	if ( commandPaths.pathValue == NULL || strcmp(commandPaths.pathValue, pathValue) != 0 ) {
+		clearPathCache();
+		free(commandPaths.pathValue);
+		commandPaths.pathValue = strdup(pathValue);
+	}
+	
+	entry = findPathEntry(name);
+	
+	//Taken on trust, spawnCommand looks again if it has gone away since
+	if ( entry ) {
+		entry->hits++;
+		return entry->path;
+	}
+	
+	//Walk PATH in order (an empty entry means the working directory)
+	for(dir = pathValue; ; dir = end + 1 ) {
+		end = strchr(dir, ':');
+		dirLength = end ? (size_t) (end - dir) : strlen(dir);
+		
+		free(uncached);
+		uncached = (char*) malloc(dirLength + strlen(name) + 3);
+		if ( dirLength == 0 ) {
+			sprintf(uncached, "./%s", name);
+		} else {
+			sprintf(uncached, "%.*s/%s", (int) dirLength, dir, name);
 		}
-		arg = strtok(NULL, " ");
+		
+		if ( isExecutable(uncached) ) {
+			if ( uncached[0] != '/' ) {
+				return uncached;
+			}
+			
+			entry = addPathEntry(name, uncached);
+			entry->hits++;
+			return entry->path;
+		}
+		
+		if ( end == NULL ) {
+			return NULL;
+		}
+	}
+}
+
+//Spawn command by its resolved path, returning what posix_spawn did (ENOENT if it isn't on PATH). A cached path that
+//has been removed or made unrunnable since it was looked up is dropped and the command resolved and spawned once more.
+int spawnCommand(pid_t* pid, simpleCommand* command, posix_spawn_file_actions_t* actions, posix_spawnattr_t* attributes){
+	char* path = resolveCommand(command->argv[0]);
+	pathEntry* entry;
+	int error;
+	
+	if ( path == NULL ) {
+		return ENOENT;
+	}
+	
+	error = posix_spawn(pid, path, actions, attributes, command->argv, environ);
+	
+	if ( (error == ENOENT || error == EACCES) && (entry = findPathEntry(command->argv[0])) != NULL && entry->path == path ) {
+		removePathEntry(entry);
+		
+		path = resolveCommand(command->argv[0]);
+		error = path ? posix_spawn(pid, path, actions, attributes, command->argv, environ) : ENOENT;
 	}
 	
-	free(cpy);
+	return error;
+}
+
+//The hash builtin: with no arguments list the cache, with -r empty it, otherwise look each name up and remember it
+void hashCommands(simpleCommand* command){
+	pathEntry* entry;
+	int i;
+	
+	if ( command->argc == 1 ) {
+		if ( commandPaths.count == 0 ) {
+			printf("hash: hash table empty\n");
+			return;
+		}
+		
+		printf("hits\tname\tpath\n");
+		for(i = 0; i < commandPaths.bucketCount; i++ ) {
+			for(entry = commandPaths.buckets[i]; entry; entry = entry->next ) {
+				printf("%4d\t%s\t%s\n", entry->hits, entry->name, entry->path);
+			}
+		}
+		return;
+	}
 	
-	return arg;
+	for(i = 1; i < command->argc; i++ ) {
+		if ( strcmp(command->argv[i], "-r") == 0 ) {
+			clearPathCache();
+		} else if ( resolveCommand(command->argv[i]) == NULL ) {
+			printf("hash: %s: not found\n", command->argv[i]);
+		} else if ( (entry = findPathEntry(command->argv[i])) != NULL ) {
+			//Looking a name up isn't a use of it
+			entry->hits--;
+		}
+	}
 }
 
  /*
-  * End Misc functions
-  */ 
+  * End command lookup
+  */
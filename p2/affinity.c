@@ -0,0 +1,284 @@
+/**
+	CPU placement for the encrypt pipeline threads (--pin).
+	
+	Topology comes from sysfs (/sys/devices/system/cpu). Anything missing there, as in containers or on single node
+	machines, just counts as one shared domain, so auto placement degrades to plain CPU order rather than failing.
+*/
+
+#define _GNU_SOURCE
+
+//CLib imports
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <sched.h>
+
+#include "affinity.h"
+
+//Where a CPU sits, outermost first. Each domain is named by the lowest CPU in it.
+typedef struct {
+	int node;
+	int l3;
+	int l2;
+	int core;
+	int cpu;
+} cpuPosition;
+
+static int parseCpuList(const char* list, int* cpus, int max);
+static int firstCpu(const char* path, int fallback);
+static int cacheDomain(int cpu, int level);
+static int cpuNode(int cpu);
+static int comparePositions(const void* a, const void* b);
+static int autoCpus(int* cpus, int max);
+
+//If spec is a placement --pin understands: auto, off or a CPU list
+int placementValid(const char* spec){
+	int cpus[CPU_SETSIZE];
+	
+	return strcmp(spec, "auto") == 0 || strcmp(spec, "off") == 0 || parseCpuList(spec, cpus, CPU_SETSIZE) > 0;
+}
+
+/**
+	Work out a CPU for each of threads pipeline threads. Returns 0 if the spec names a CPU this process may not run on. With
+	"off" (or a NULL spec) nothing is pinned.
+*/
+int placementInit(placement* p, const char* spec, int threads){
+	int cpus[CPU_SETSIZE];
+	cpu_set_t allowed;
+	int count, i;
+	
+	p->cpus = NULL;
+	p->count = threads;
+	
+	if ( spec == NULL || strcmp(spec, "off") == 0 ) {
+		return 1;
+	}
+	
+	if ( strcmp(spec, "auto") == 0 ) {
+		count = autoCpus(cpus, CPU_SETSIZE);
+	} else {
+		count = parseCpuList(spec, cpus, CPU_SETSIZE);
+		
+		CPU_ZERO(&allowed);
+		sched_getaffinity(0, sizeof(allowed), &allowed);
+		for(i = 0; i < count; i++ ) {
+			if ( !CPU_ISSET(cpus[i], &allowed) ) {
+				printf("CPU %d is not available \n", cpus[i]);
+				return 0;
+			}
+		}
+	}
+	
+	if ( count <= 0 ) {
+		return 1;
+	}
+	
+	p->cpus = (int*) malloc(sizeof(int) * threads);
+	for(i = 0; i < threads; i++ ) {
+		p->cpus[i] = cpus[i % count];
+	}
+	
+	return 1;
+}
+
+void placementDestroy(placement* p){
+	free(p->cpus);
+	p->cpus = NULL;
+}
+
+//CPU for a pipeline thread, or -1 to leave it to the scheduler
+int placementCpu(const placement* p, int thread){
+	return p->cpus == NULL ? -1 : p->cpus[thread];
+}
+
+//pthread_create, started on cpu (unless it is -1) so the thread's first allocations are already local
+int startPinned(pthread_t* thread, int cpu, void* (*routine)(void*), void* args){
+	pthread_attr_t attributes;
+	cpu_set_t set;
+	int result;
+	
+	if ( cpu < 0 ) {
+		return pthread_create(thread, NULL, routine, args);
+	}
+	
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	pthread_attr_init(&attributes);
+	pthread_attr_setaffinity_np(&attributes, sizeof(set), &set);
+	result = pthread_create(thread, &attributes, routine, args);
+	pthread_attr_destroy(&attributes);
+	
+	return result;
+}
+
+//Parse a sysfs style CPU list ("0-3,8,10-11") into cpus. Returns the number found, or 0 if it isn't a list.
+static int parseCpuList(const char* list, int* cpus, int max){
+	const char* at = list;
+	char* end;
+	long first, last;
+	int count = 0;
+	
+	while ( *at != '\0' && *at != '\n' ) {
+		if ( !isdigit((unsigned char) *at) ) {
+			return 0;
+		}
+		
+		first = strtol(at, &end, 10);
+		last = first;
+		if ( *end == '-' ) {
+			if ( !isdigit((unsigned char) end[1]) ) {
+				return 0;
+			}
+			last = strtol(end + 1, &end, 10);
+		}
+		
+		if ( last < first || last >= CPU_SETSIZE ) {
+			return 0;
+		}
+		
+		for(; first <= last && count < max; first++ ) {
+			cpus[count++] = (int) first;
+		}
+		
+		at = end;
+		if ( *at == ',' ) {
+			at++;
+		} else if ( *at != '\0' && *at != '\n' ) {
+			return 0;
+		}
+	}
+	
+	return count;
+}
+
+//Lowest CPU in the list stored at path, or fallback if it can't be read
+static int firstCpu(const char* path, int fallback){
+	char list[4096];
+	int cpus[1];
+	FILE* file = fopen(path, "r");
+	
+	if ( file == NULL ) {
+		return fallback;
+	}
+	
+	if ( fgets(list, sizeof(list), file) == NULL || parseCpuList(list, cpus, 1) != 1 ) {
+		cpus[0] = fallback;
+	}
+	
+	fclose(file);
+	
+	return cpus[0];
+}
+
+//Lowest CPU sharing cpu's cache of the given level, or -1 if there is no such cache
+static int cacheDomain(int cpu, int level){
+	char path[256];
+	FILE* file;
+	int index, found;
+	
+	for(index = 0; ; index++ ) {
+		sprintf(path, "/sys/devices/system/cpu/cpu%d/cache/index%d/level", cpu, index);
+		file = fopen(path, "r");
+		if ( file == NULL ) {
+			return -1;
+		}
+		
+		if ( fscanf(file, "%d", &found) != 1 ) {
+			found = 0;
+		}
+		fclose(file);
+		
+		if ( found == level ) {
+			sprintf(path, "/sys/devices/system/cpu/cpu%d/cache/index%d/shared_cpu_list", cpu, index);
+			return firstCpu(path, cpu);
+		}
+	}
+}
+
+//NUMA node of cpu (the nodeN entry in its sysfs directory), 0 if there is none
+static int cpuNode(int cpu){
+	char path[256];
+	struct dirent* entry;
+	DIR* directory;
+	int node = 0;
+	
+	sprintf(path, "/sys/devices/system/cpu/cpu%d", cpu);
+	directory = opendir(path);
+	if ( directory == NULL ) {
+		return 0;
+	}
+	
+	while ( (entry = readdir(directory)) != NULL ) {
+		if ( strncmp(entry->d_name, "node", 4) == 0 && isdigit((unsigned char) entry->d_name[4]) ) {
+			node = atoi(entry->d_name + 4);
+			break;
+		}
+	}
+	
+	closedir(directory);
+	
+	return node;
+}
+
+static int comparePositions(const void* a, const void* b){
+	const cpuPosition* x = (const cpuPosition*) a;
+	const cpuPosition* y = (const cpuPosition*) b;
+	
+	if ( x->node != y->node ) {
+		return x->node - y->node;
+	}
+	
+	if ( x->l3 != y->l3 ) {
+		return x->l3 - y->l3;
+	}
+	
+	if ( x->l2 != y->l2 ) {
+		return x->l2 - y->l2;
+	}
+	
+	if ( x->core != y->core ) {
+		return x->core - y->core;
+	}
+	
+	return x->cpu - y->cpu;
+}
+
+//The CPUs this process may use, nearest neighbours next to each other. Returns how many there are.
+static int autoCpus(int* cpus, int max){
+	cpuPosition* positions = (cpuPosition*) malloc(sizeof(cpuPosition) * CPU_SETSIZE);
+	char path[256];
+	cpu_set_t allowed;
+	int count = 0;
+	int cpu, i;
+	
+	if ( positions == NULL || sched_getaffinity(0, sizeof(allowed), &allowed) < 0 ) {
+		free(positions);
+		return 0;
+	}
+	
+	for(cpu = 0; cpu < CPU_SETSIZE; cpu++ ) {
+		if ( !CPU_ISSET(cpu, &allowed) ) {
+			continue;
+		}
+		
+		sprintf(path, "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+		positions[count].node = cpuNode(cpu);
+		positions[count].l3 = cacheDomain(cpu, 3);
+		positions[count].l2 = cacheDomain(cpu, 2);
+		positions[count].core = firstCpu(path, cpu);
+		positions[count].cpu = cpu;
+		count++;
+	}
+	
+	qsort(positions, count, sizeof(cpuPosition), comparePositions);
+	
+	for(i = 0; i < count && i < max; i++ ) {
+		cpus[i] = positions[i].cpu;
+	}
+	
+	free(positions);
+	
+	return i;
+}
@@ -0,0 +1,27 @@
+/**
+	CPU placement for the encrypt pipeline threads (--pin).
+	
+	A placement gives every pipeline thread, in pipeline order (reader, input counter, the -t encrypters, output counter,
+	writer), a CPU to run on. "auto" orders the CPUs we may use by NUMA node, L3 domain, L2 domain and core, so adjacent
+	stages land on SMT siblings or at least a shared cache; a list ("0,2,4-7") is used as given. Either wraps around when
+	there are more threads than CPUs.
+*/
+
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <pthread.h>
+
+typedef struct {
+	int* cpus; //CPU for each pipeline thread, or NULL when nothing is pinned
+	int count; //Number of pipeline threads
+} placement;
+
+int placementValid(const char* spec);
+int placementInit(placement* p, const char* spec, int threads);
+void placementDestroy(placement* p);
+int placementCpu(const placement* p, int thread);
+
+int startPinned(pthread_t* thread, int cpu, void* (*routine)(void*), void* args);
+
+#endif
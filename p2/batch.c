@@ -0,0 +1,429 @@
+/**
+	Batch mode for the encrypt program.
+	
+	The file list is split into one contiguous range per worker. A worker takes files from the front of its own range and,
+	once that is empty, steals single files from the back of another worker's range, so a few large files don't leave the
+	rest of the pool idle. Each range has its own lock, which is only contended while stealing.
+	
+	Every file starts from s = 1 with its own histograms, exactly as if encrypt had been run on it alone. The aggregate
+	histograms are the sum of the per file ones.
+*/
+
+//CLib imports
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "batch.h"
+#include "encryptlib.h"
+
+//A worker's share of the files, [begin, end) into the file list
+typedef struct {
+	pthread_mutex_t lock;
+	int begin;
+	int end;
+} batchRange;
+
+//State shared by the pool
+typedef struct {
+	batchFile* files;
+	int fileCount;
+	batchRange* ranges;
+	int workers;
+	int blockSize;
+	int decrypt; //--decrypt
+} batchPool;
+
+//Worker arguments
+typedef struct {
+	batchPool* pool;
+	int id;
+} batchWorker;
+
+static int addFile(batchFile** files, int* count, int* allocated, const char* input, const char* outputDir);
+static int readManifest(const char* path, const char* outputDir, batchFile** files, int* count);
+static int readDirectory(const char* path, const char* outputDir, batchFile** files, int* count);
+static int compareFiles(const void* a, const void* b);
+static int compareOutputs(const void* a, const void* b);
+static int checkOutputs(batchFile* files, int count, const char* outputDir);
+static void freeFiles(batchFile* files, int count);
+static int takeFile(batchPool* pool, int id);
+static void* batchThread(void* args);
+
+/**
+	Encrypts (or decrypts) every file of a manifest or directory into outputDir with a pool of workers, then prints each
+	file's histograms followed by the totals. Returns 0 if the file list couldn't be built, two files would share an output or any file failed.
+*/
+int runBatch(const char* source, const char* outputDir, int workers, int blockSize, int decrypt){
+	struct stat info;
+	batchFile* files = NULL;
+	int fileCount = 0;
+	batchPool pool;
+	batchWorker* args;
+	pthread_t* threads;
+	histogram totalIn, totalOut;
+	int i, per, failed = 0;
+	
+	if ( stat(source, &info) < 0 ) {
+		printf("Batch source doesn't exist \n");
+		return 0;
+	}
+	
+	if ( mkdir(outputDir, 0777) < 0 && errno != EEXIST ) {
+		printf("Could not create output directory \n");
+		return 0;
+	}
+	
+	if ( !(S_ISDIR(info.st_mode) ? readDirectory(source, outputDir, &files, &fileCount) : readManifest(source, outputDir, &files, &fileCount)) ) {
+		printf("Could not read batch source \n");
+		freeFiles(files, fileCount);
+		return 0;
+	}
+	
+	if ( !checkOutputs(files, fileCount, outputDir) ) {
+		freeFiles(files, fileCount);
+		return 0;
+	}
+	
+	//No point in more workers than files
+	if ( workers > fileCount ) {
+		workers = fileCount > 0 ? fileCount : 1;
+	}
+	
+	pool.files = files;
+	pool.fileCount = fileCount;
+	pool.workers = workers;
+	pool.blockSize = blockSize;
+	pool.decrypt = decrypt;
+	pool.ranges = (batchRange*) malloc(sizeof(batchRange) * workers);
+	args = (batchWorker*) malloc(sizeof(batchWorker) * workers);
+	threads = (pthread_t*) malloc(sizeof(pthread_t) * workers);
+	
+	//Equal contiguous ranges, the first few one longer
+	per = fileCount / workers;
+	for(i = 0; i < workers; i++ ) {
+		pthread_mutex_init(&pool.ranges[i].lock, NULL);
+		pool.ranges[i].begin = i * per + (i < fileCount % workers ? i : fileCount % workers);
+		pool.ranges[i].end = pool.ranges[i].begin + per + (i < fileCount % workers);
+	}
+	
+	for(i = 0; i < workers; i++ ) {
+		args[i].pool = &pool;
+		args[i].id = i;
+		pthread_create(&threads[i], NULL, batchThread, &args[i]);
+	}
+	
+	for(i = 0; i < workers; i++ ) {
+		pthread_join(threads[i], NULL);
+		pthread_mutex_destroy(&pool.ranges[i].lock);
+	}
+	
+	//Report in list order
+	histogramClear(&totalIn);
+	histogramClear(&totalOut);
+	
+	for(i = 0; i < fileCount; i++ ) {
+		printf("File: %s \n", files[i].input);
+		
+		if ( files[i].failed ) {
+			printf("Could not encrypt this file \n");
+			failed++;
+		} else {
+			histogramPrint(stdout, "Input Counts:", &files[i].inputCount);
+			histogramPrint(stdout, "Output Counts:", &files[i].outputCount);
+			histogramMerge(&totalIn, &files[i].inputCount);
+			histogramMerge(&totalOut, &files[i].outputCount);
+		}
+	}
+	
+	printf("Files: %d encrypted, %d failed \n", fileCount - failed, failed);
+	histogramPrint(stdout, "Total Input Counts:", &totalIn);
+	histogramPrint(stdout, "Total Output Counts:", &totalOut);
+	
+	freeFiles(files, fileCount);
+	free(pool.ranges);
+	free(args);
+	free(threads);
+	
+	return failed == 0;
+}
+
+//Append a file (written to outputDir under its base name) to a growing list. Returns 0 if out of memory.
+static int addFile(batchFile** files, int* count, int* allocated, const char* input, const char* outputDir){
+	const char* name = strrchr(input, '/');
+	batchFile* file;
+	
+	name = (name == NULL) ? input : name + 1;
+	
+	if ( *count == *allocated ) {
+		*allocated = (*allocated == 0) ? 64 : *allocated * 2;
+		file = (batchFile*) realloc(*files, sizeof(batchFile) * *allocated);
+		if ( file == NULL ) {
+			return 0;
+		}
+		*files = file;
+	}
+	
+	file = &(*files)[*count];
+	file->input = strdup(input);
+	file->output = (char*) malloc(strlen(outputDir) + strlen(name) + 2);
+	if ( file->input == NULL || file->output == NULL ) {
+		free(file->input);
+		free(file->output);
+		return 0;
+	}
+	sprintf(file->output, "%s/%s", outputDir, name);
+	file->failed = 0;
+	
+	(*count)++;
+	return 1;
+}
+
+//Files listed one per line (blank lines skipped, lines of any length)
+static int readManifest(const char* path, const char* outputDir, batchFile** files, int* count){
+	FILE* manifest = fopen(path, "r");
+	char* line = NULL;
+	size_t lineSize = 0;
+	ssize_t length;
+	int allocated = 0;
+	int ok = 1;
+	
+	if ( manifest == NULL ) {
+		return 0;
+	}
+	
+	while ( ok && (length = getline(&line, &lineSize, manifest)) > 0 ) {
+		if ( line[length - 1] == '\n' ) {
+			line[--length] = '\0';
+		}
+		
+		if ( length > 0 ) {
+			ok = addFile(files, count, &allocated, line, outputDir);
+		}
+	}
+	
+	free(line);
+	fclose(manifest);
+	
+	return ok;
+}
+
+//Regular files directly inside a directory, sorted by name so reports come out in a stable order
+static int readDirectory(const char* path, const char* outputDir, batchFile** files, int* count){
+	DIR* dir = opendir(path);
+	struct dirent* entry;
+	struct stat info;
+	char* input;
+	int allocated = 0;
+	int ok = 1;
+	
+	if ( dir == NULL ) {
+		return 0;
+	}
+	
+	while ( ok && (entry = readdir(dir)) != NULL ) {
+		input = (char*) malloc(strlen(path) + strlen(entry->d_name) + 2);
+		if ( input == NULL ) {
+			ok = 0;
+			break;
+		}
+		sprintf(input, "%s/%s", path, entry->d_name);
+		
+		if ( stat(input, &info) == 0 && S_ISREG(info.st_mode) ) {
+			ok = addFile(files, count, &allocated, input, outputDir);
+		}
+		
+		free(input);
+	}
+	
+	closedir(dir);
+	
+	if ( ok && *count > 1 ) {
+		qsort(*files, *count, sizeof(batchFile), compareFiles);
+	}
+	
+	return ok;
+}
+
+static int compareFiles(const void* a, const void* b){
+	return strcmp(((const batchFile*) a)->input, ((const batchFile*) b)->input);
+}
+
+//Order by output path, so files that would share one end up next to each other
+static int compareOutputs(const void* a, const void* b){
+	return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+/**
+	Make sure every file gets an output of its own: no two inputs with the same base name (they would be written to the
+	same file at once) and no input inside outputDir itself (its output would replace it). Returns 0 after saying why.
+*/
+static int checkOutputs(batchFile* files, int count, const char* outputDir){
+	struct stat outputInfo, inputInfo;
+	char** outputs;
+	char* directory;
+	char* slash;
+	int i, ok = 1;
+	
+	if ( stat(outputDir, &outputInfo) < 0 ) {
+		printf("Could not create output directory \n");
+		return 0;
+	}
+	
+	for(i = 0; i < count && ok; i++ ) {
+		directory = strdup(files[i].input);
+		if ( directory == NULL ) {
+			return 0;
+		}
+		
+		slash = strrchr(directory, '/');
+		if ( slash == NULL ) {
+			strcpy(directory, ".");
+		} else {
+			//Keep the / of a file in the root directory
+			slash[slash == directory] = '\0';
+		}
+		
+		if ( stat(directory, &inputInfo) == 0 && inputInfo.st_dev == outputInfo.st_dev && inputInfo.st_ino == outputInfo.st_ino ) {
+			printf("Output directory can't be the directory of an input: %s \n", files[i].input);
+			ok = 0;
+		}
+		
+		free(directory);
+	}
+	
+	outputs = (char**) malloc(sizeof(char*) * (count > 0 ? count : 1));
+	if ( !ok || outputs == NULL ) {
+		free(outputs);
+		return 0;
+	}
+	
+	for(i = 0; i < count; i++ ) {
+		outputs[i] = files[i].output;
+	}
+	
+	qsort(outputs, count, sizeof(char*), compareOutputs);
+	
+	for(i = 1; i < count && ok; i++ ) {
+		if ( strcmp(outputs[i - 1], outputs[i]) == 0 ) {
+			printf("Two inputs would both be written to %s \n", outputs[i]);
+			ok = 0;
+		}
+	}
+	
+	free(outputs);
+	
+	return ok;
+}
+
+static void freeFiles(batchFile* files, int count){
+	int i;
+	
+	for(i = 0; i < count; i++ ) {
+		free(files[i].input);
+		free(files[i].output);
+	}
+	
+	free(files);
+}
+
+/**
+	Next file for a worker: the front of its own range, or else one stolen from the back of the first other range that
+	still has files. Returns -1 once every range is empty.
+*/
+static int takeFile(batchPool* pool, int id){
+	batchRange* range;
+	int index = -1;
+	int i;
+	
+	for(i = 0; i < pool->workers && index < 0; i++ ) {
+		range = &pool->ranges[(id + i) % pool->workers];
+		
+		pthread_mutex_lock(&range->lock);
+		if ( range->begin < range->end ) {
+			index = (i == 0) ? range->begin++ : --range->end;
+		}
+		pthread_mutex_unlock(&range->lock);
+	}
+	
+	return index;
+}
+
+//Worker thread, encrypting files until there are none left to take or steal
+static void* batchThread(void* args){
+	batchWorker* worker = (batchWorker*) args;
+	batchPool* pool = worker->pool;
+	encrypt_context* ctx = encrypt_create();
+	char* buffer = (char*) malloc(pool->blockSize);
+	batchFile* file;
+	int index;
+	
+	if ( ctx != NULL ) {
+		encrypt_set_decrypt(ctx, pool->decrypt);
+	}
+	
+	while ( (index = takeFile(pool, worker->id)) >= 0 ) {
+		file = &pool->files[index];
+		
+		if ( ctx == NULL || buffer == NULL || !encryptPath(ctx, file->input, file->output, buffer, pool->blockSize) ) {
+			file->failed = 1;
+		} else {
+			memcpy(file->inputCount.counts, encrypt_input_counts(ctx), sizeof(file->inputCount.counts));
+			memcpy(file->outputCount.counts, encrypt_output_counts(ctx), sizeof(file->outputCount.counts));
+		}
+	}
+	
+	encrypt_destroy(ctx);
+	free(buffer);
+	return (void*) NULL;
+}
+
+/**
+	Encrypts one file into another in a single pass, a block at a time through a caller's buffer, counting both sides in
+	the context (which is reset first, so its counts cover just this file). Returns 0 if either file couldn't be opened,
+	read or written.
+*/
+int encryptPath(encrypt_context* ctx, const char* input, const char* output, char* buffer, int blockSize){
+	FILE* in = fopen(input, "r");
+	FILE* out;
+	int length;
+	int ok = 1;
+	
+	encrypt_reset(ctx);
+	
+	if ( in == NULL ) {
+		return 0;
+	}
+	
+	out = fopen(output, "w");
+	if ( out == NULL ) {
+		fclose(in);
+		return 0;
+	}
+	
+	do {
+		length = (int) fread(buffer, 1, blockSize, in);
+		encrypt_update(ctx, buffer, buffer, length);
+		
+		if ( fwrite(buffer, 1, length, out) != (size_t) length ) {
+			ok = 0;
+		}
+	} while ( length == blockSize );
+	
+	if ( ferror(in) ) {
+		ok = 0;
+	}
+	
+	encrypt_finish(ctx);
+	
+	fclose(in);
+	if ( fclose(out) != 0 ) {
+		ok = 0;
+	}
+	
+	return ok;
+}
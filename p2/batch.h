@@ -0,0 +1,27 @@
+/**
+	Batch mode for the encrypt program (--batch).
+	
+	Encrypts every file named in a manifest (one path per line) or found in a directory, writing each one to an output
+	directory under its own name. Files are spread over a fixed pool of worker threads, each running the fused single pass
+	per file, and idle workers steal files from busy ones.
+*/
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "histogram.h"
+#include "encryptlib.h"
+
+//One file of a batch and its results
+typedef struct {
+	char* input; //Path of the file to encrypt
+	char* output; //Where its encryption goes
+	int failed; //If it couldn't be read or written
+	histogram inputCount;
+	histogram outputCount;
+} batchFile;
+
+int runBatch(const char* source, const char* outputDir, int workers, int blockSize, int decrypt);
+int encryptPath(encrypt_context* ctx, const char* input, const char* output, char* buffer, int blockSize);
+
+#endif
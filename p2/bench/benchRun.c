@@ -0,0 +1,70 @@
+/**
+	Runs a command several times and reports its best wall time with the resource usage of that run.
+	
+	Usage: benchRun repeat command [args...]
+	Prints: wall_ms,maxrss_kb,voluntary_csw,involuntary_csw
+	
+	The command's stdout and stderr are discarded. Exits non-zero if any run fails or is killed by a signal.
+*/
+
+//CLib imports
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+int main(int argc, char** argv) {
+	struct timespec start, end;
+	struct rusage usage;
+	double wall;
+	double bestWall = -1;
+	long bestRss = 0, bestVoluntary = 0, bestInvoluntary = 0;
+	int repeat, i, status, devNull;
+	pid_t pid;
+	
+	if ( argc < 3 || (repeat = atoi(argv[1])) <= 0 ) {
+		printf("Incorrect format. Should be: ./benchRun repeat command [args...] \n");
+		return 1;
+	}
+	
+	for(i = 0; i < repeat; i++ ) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		
+		pid = fork();
+		if ( pid == -1 ) {
+			perror("fork");
+			return 1;
+		} else if ( pid == 0 ) {
+			devNull = open("/dev/null", O_WRONLY);
+			dup2(devNull, STDOUT_FILENO);
+			dup2(devNull, STDERR_FILENO);
+			
+			execvp(argv[2], argv + 2);
+			_exit(127);
+		}
+		
+		wait4(pid, &status, 0, &usage);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		
+		if ( !WIFEXITED(status) || WEXITSTATUS(status) != 0 ) {
+			printf("%s failed \n", argv[2]);
+			return 1;
+		}
+		
+		wall = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0;
+		
+		if ( bestWall < 0 || wall < bestWall ) {
+			bestWall = wall;
+			bestRss = usage.ru_maxrss;
+			bestVoluntary = usage.ru_nvcsw;
+			bestInvoluntary = usage.ru_nivcsw;
+		}
+	}
+	
+	printf("%.3f,%ld,%ld,%ld\n", bestWall, bestRss, bestVoluntary, bestInvoluntary);
+	
+	return 0;
+}
@@ -0,0 +1,46 @@
+# Compares job latency of cold ./encrypt runs against a running server (encrypt --serve), for small inputs where
+# startup dominates.
+#
+# Usage: sh bench/daemonBench.sh
+#
+# Environment (defaults in brackets):
+#   BENCH_SIZES    input sizes, K/M suffixes   [1K 64K 1M]
+#   BENCH_REPEAT   jobs per measurement        [200]
+#   BENCH_WORK     where generated inputs are kept   [/tmp/encryptBench]
+
+BENCH_DIR=$(dirname "$0")
+SIZES=${BENCH_SIZES:-"1K 64K 1M"}
+REPEAT=${BENCH_REPEAT:-200}
+WORK=${BENCH_WORK:-/tmp/encryptBench}
+
+mkdir -p "$WORK" || exit 1
+WORK=$(cd "$WORK" && pwd)
+SOCKET=$WORK/encrypt.sock
+
+cd "$BENCH_DIR/.." || exit 1
+
+./encrypt --serve "$SOCKET" -t 2 2> /dev/null &
+SERVER=$!
+trap 'kill $SERVER 2> /dev/null' EXIT
+
+#Wait for the server to start listening
+i=0
+while [ ! -S "$SOCKET" ] && [ $i -lt 50 ]; do
+	sleep 0.1
+	i=$((i + 1))
+done
+
+if [ ! -S "$SOCKET" ]; then
+	echo "Server did not start on $SOCKET"
+	exit 1
+fi
+
+for size in $SIZES; do
+	input=$WORK/text_$size
+	[ -f "$input" ] || bench/genInput text "$size" "$input" || exit 1
+	
+	echo "Input: text $size"
+	bench/latencyBench "$SOCKET" "$REPEAT" "$input" "$WORK/latency_out" || exit 1
+done
+
+rm -f "$WORK/latency_out"
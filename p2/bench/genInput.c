@@ -0,0 +1,135 @@
+/**
+	Deterministic input generator for the encrypt benchmarks.
+	
+	Usage: genInput kind size outputfile
+	
+	kind is one of letters (only A-Z/a-z), nonletters (digits, punctuation and whitespace), text (words, punctuation and
+	lines like prose) or binary (every byte value). size takes a K, M or G suffix. The same kind and size always produce
+	the same bytes.
+*/
+
+//CLib imports
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define CHUNK_SIZE (1 << 20)
+
+//xorshift64*, seeded per kind so every run generates the same file
+uint64_t state;
+
+uint64_t nextRandom(){
+	state ^= state >> 12;
+	state ^= state << 25;
+	state ^= state >> 27;
+	
+	return state * 2685821657736338717ULL;
+}
+
+//Parse a byte count with an optional K, M or G suffix. Returns -1 if it isn't one.
+long long parseSize(const char* text){
+	char* end;
+	long long size = strtoll(text, &end, 10);
+	
+	switch ( *end ) {
+		case 'k': case 'K': size <<= 10; end++; break;
+		case 'm': case 'M': size <<= 20; end++; break;
+		case 'g': case 'G': size <<= 30; end++; break;
+	}
+	
+	if ( end == text || *end != '\0' || size < 0 ) {
+		return -1;
+	}
+	
+	return size;
+}
+
+//Fill a chunk with characters of the given kind
+void fill(const char* kind, unsigned char* data, int length){
+	static const char letters[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+	static const char nonletters[] = "0123456789 \n\t.,;:!?-_()[]{}<>/\\|@#$%^&*+=~'\"";
+	int i = 0;
+	int word;
+	uint64_t r;
+	
+	if ( strcmp(kind, "letters") == 0 ) {
+		for( ; i < length; i++ ) {
+			data[i] = letters[nextRandom() % 52];
+		}
+	} else if ( strcmp(kind, "nonletters") == 0 ) {
+		for( ; i < length; i++ ) {
+			data[i] = nonletters[nextRandom() % (sizeof(nonletters) - 1)];
+		}
+	} else if ( strcmp(kind, "binary") == 0 ) {
+		for( ; i < length; i++ ) {
+			data[i] = (unsigned char) (nextRandom() >> 56);
+		}
+	} else {
+		//Mostly lowercase words of 1-10 letters, some capitalized, separated by spaces, punctuation and newlines
+		while ( i < length ) {
+			r = nextRandom();
+			word = 1 + (int) (r % 10);
+			
+			for( ; word > 0 && i < length; word-- ) {
+				data[i++] = letters[26 + (nextRandom() % 26)];
+			}
+			
+			if ( (r >> 8) % 7 == 0 && i > 0 && data[i - 1] >= 'a' ) {
+				data[i - 1] -= 'a' - 'A';
+			}
+			
+			if ( i < length ) {
+				data[i++] = ((r >> 16) % 12 == 0) ? '\n' : ((r >> 24) % 9 == 0) ? nonletters[11 + (r >> 32) % 6] : ' ';
+			}
+		}
+	}
+}
+
+int main(int argc, char** argv) {
+	unsigned char* chunk;
+	long long size, written;
+	int length;
+	FILE* out;
+	const char* kind;
+	
+	if ( argc != 4 || (size = parseSize(argv[2])) < 0 ) {
+		printf("Incorrect format. Should be: ./genInput letters|nonletters|text|binary size outputfile \n");
+		return 1;
+	}
+	
+	kind = argv[1];
+	if ( strcmp(kind, "letters") != 0 && strcmp(kind, "nonletters") != 0 && strcmp(kind, "text") != 0 && strcmp(kind, "binary") != 0 ) {
+		printf("Unknown input kind %s \n", kind);
+		return 1;
+	}
+	
+	out = fopen(argv[3], "w");
+	if ( out == NULL ) {
+		printf("Could not open %s \n", argv[3]);
+		return 1;
+	}
+	
+	//Seed from the kind name
+	state = 0x9E3779B97F4A7C15ULL;
+	for(length = 0; kind[length]; length++ ) {
+		state = (state ^ (unsigned char) kind[length]) * 1099511628211ULL;
+	}
+	
+	chunk = (unsigned char*) malloc(CHUNK_SIZE);
+	
+	for(written = 0; written < size; written += length ) {
+		length = (size - written < CHUNK_SIZE) ? (int) (size - written) : CHUNK_SIZE;
+		fill(kind, chunk, length);
+		
+		if ( fwrite(chunk, 1, length, out) != (size_t) length ) {
+			printf("Error writing %s \n", argv[3]);
+			return 1;
+		}
+	}
+	
+	free(chunk);
+	fclose(out);
+	
+	return 0;
+}
@@ -0,0 +1,141 @@
+/**
+	Compares per-job latency of a cold ./encrypt run against the same job sent to a running server (encrypt --serve).
+	
+	Usage: latencyBench socket repeat inputfile outputfile
+	Prints one line per way of running the job: name,mean_us,p50_us,p99_us
+	
+		cold     fork and exec ./encrypt inputfile outputfile
+		client   fork and exec ./encryptClient, which sends the paths to the server
+		path     send the paths to the server from this process
+		inline   stream the input through the socket from this process
+	
+	The first two include process startup on both sides of the comparison; the last two show what is left for a caller
+	that links daemonClient.c and keeps its own process.
+*/
+
+//CLib imports
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include "../daemon.h"
+
+typedef int (*job)(const char* socketPath, const char* input, const char* output);
+
+static int runCold(const char* socketPath, const char* input, const char* output);
+static int runClient(const char* socketPath, const char* input, const char* output);
+static int runPath(const char* socketPath, const char* input, const char* output);
+static int runInline(const char* socketPath, const char* input, const char* output);
+static int runCommand(char** args);
+static int compareTimes(const void* a, const void* b);
+
+int main(int argc, char** argv) {
+	const char* names[] = {"cold", "client", "path", "inline"};
+	job jobs[] = {runCold, runClient, runPath, runInline};
+	struct timespec start, end;
+	double* times;
+	double total;
+	int repeat, i, j;
+	
+	if ( argc != 5 || (repeat = atoi(argv[2])) <= 0 || argv[3][0] != '/' || argv[4][0] != '/' ) {
+		printf("Incorrect format. Should be: ./latencyBench socket repeat /absolute/inputfile /absolute/outputfile \n");
+		return 1;
+	}
+	
+	times = (double*) malloc(sizeof(double) * repeat);
+	
+	printf("name,mean_us,p50_us,p99_us\n");
+	
+	for(i = 0; i < 4; i++ ) {
+		total = 0;
+		
+		for(j = 0; j < repeat; j++ ) {
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			
+			if ( !jobs[i](argv[1], argv[3], argv[4]) ) {
+				printf("%s failed \n", names[i]);
+				return 1;
+			}
+			
+			clock_gettime(CLOCK_MONOTONIC, &end);
+			times[j] = (end.tv_sec - start.tv_sec) * 1000000.0 + (end.tv_nsec - start.tv_nsec) / 1000.0;
+			total += times[j];
+		}
+		
+		qsort(times, repeat, sizeof(double), compareTimes);
+		printf("%s,%.1f,%.1f,%.1f\n", names[i], total / repeat, times[repeat / 2], times[(repeat * 99) / 100]);
+	}
+	
+	free(times);
+	
+	return 0;
+}
+
+static int runCold(const char* socketPath, const char* input, const char* output){
+	char* args[] = {"./encrypt", "-s", "8", (char*) input, (char*) output, NULL};
+	
+	return runCommand(args);
+}
+
+static int runClient(const char* socketPath, const char* input, const char* output){
+	char* args[] = {"./encryptClient", "--socket", (char*) socketPath, (char*) input, (char*) output, NULL};
+	
+	return runCommand(args);
+}
+
+static int runPath(const char* socketPath, const char* input, const char* output){
+	histogram inputCount, outputCount;
+	int fd = daemonConnect(socketPath);
+	
+	return fd >= 0 && daemonEncryptPath(fd, 0, input, output, &inputCount, &outputCount);
+}
+
+static int runInline(const char* socketPath, const char* input, const char* output){
+	histogram inputCount, outputCount;
+	FILE* in = fopen(input, "r");
+	FILE* out = fopen(output, "w");
+	int fd = daemonConnect(socketPath);
+	int ok = in != NULL && out != NULL && fd >= 0 && daemonEncryptStream(fd, 0, in, out, &inputCount, &outputCount);
+	
+	if ( in != NULL ) {
+		fclose(in);
+	}
+	
+	if ( out != NULL ) {
+		fclose(out);
+	}
+	
+	return ok;
+}
+
+//Run a command with its output discarded. Returns 0 if it couldn't be run or failed.
+static int runCommand(char** args){
+	int status, devNull;
+	pid_t pid = fork();
+	
+	if ( pid == -1 ) {
+		return 0;
+	} else if ( pid == 0 ) {
+		devNull = open("/dev/null", O_RDWR);
+		dup2(devNull, STDIN_FILENO);
+		dup2(devNull, STDOUT_FILENO);
+		dup2(devNull, STDERR_FILENO);
+		
+		execv(args[0], args);
+		_exit(127);
+	}
+	
+	waitpid(pid, &status, 0);
+	
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static int compareTimes(const void* a, const void* b){
+	double difference = *(const double*) a - *(const double*) b;
+	
+	return (difference > 0) - (difference < 0);
+}
@@ -0,0 +1,88 @@
+# Benchmarks ./encrypt over a matrix of generated inputs, buffer sizes and thread counts.
+#
+# Usage: sh bench/runBench.sh [--baseline]
+#
+# Results go to bench/results.csv. With --baseline they are also saved as bench/baseline.csv; otherwise, if a baseline
+# exists, the run fails when any configuration's throughput drops more than BENCH_THRESHOLD percent below it.
+#
+# Environment (defaults in brackets):
+#   BENCH_KINDS      input kinds                       [letters nonletters text binary]
+#   BENCH_SIZES      input sizes, K/M/G suffixes        [64K 1M 32M]     (e.g. "1K 1M 1G 4G" for a full run)
+#   BENCH_BUFFERS    buffer sizes in blocks             [1 8 64]
+#   BENCH_THREADS    encryption thread counts           [1 4]
+#   BENCH_FLAGS      extra encrypt flags                []
+#   BENCH_REPEAT     runs per configuration (best kept) [3]
+#   BENCH_THRESHOLD  allowed regression in percent      [20]
+#   BENCH_WORK       where generated inputs are kept    [/tmp/encryptBench]
+
+BENCH_DIR=$(dirname "$0")
+ENCRYPT=${ENCRYPT:-$BENCH_DIR/../encrypt}
+KINDS=${BENCH_KINDS:-"letters nonletters text binary"}
+SIZES=${BENCH_SIZES:-"64K 1M 32M"}
+BUFFERS=${BENCH_BUFFERS:-"1 8 64"}
+THREADS=${BENCH_THREADS:-"1 4"}
+REPEAT=${BENCH_REPEAT:-3}
+THRESHOLD=${BENCH_THRESHOLD:-20}
+WORK=${BENCH_WORK:-/tmp/encryptBench}
+RESULTS=$BENCH_DIR/results.csv
+BASELINE=$BENCH_DIR/baseline.csv
+
+mkdir -p "$WORK" || exit 1
+
+echo "kind,size,buffer,threads,mb_per_s,wall_ms,maxrss_kb,voluntary_csw,involuntary_csw" > "$RESULTS"
+
+for kind in $KINDS; do
+	for size in $SIZES; do
+		input=$WORK/$kind-$size
+		
+		#Inputs are deterministic, so generate each one once
+		if [ ! -f "$input" ]; then
+			"$BENCH_DIR/genInput" "$kind" "$size" "$input" || exit 1
+		fi
+		
+		bytes=$(wc -c < "$input")
+		
+		for buffer in $BUFFERS; do
+			for threads in $THREADS; do
+				usage=$("$BENCH_DIR/benchRun" "$REPEAT" "$ENCRYPT" -s "$buffer" -t "$threads" $BENCH_FLAGS "$input" "$WORK/out") || { echo "$usage"; exit 1; }
+				
+				echo "$kind,$size,$buffer,$threads,$usage" | awk -F, -v bytes="$bytes" \
+					'{ printf "%s,%s,%s,%s,%.1f,%s,%s,%s,%s\n", $1, $2, $3, $4, (bytes / 1000000) / ($5 / 1000), $5, $6, $7, $8 }' >> "$RESULTS"
+			done
+		done
+	done
+done
+
+rm -f "$WORK/out"
+
+#Table of the results
+awk -F, '{ printf "%-11s %-6s %-7s %-8s %-10s %-10s %-11s %-14s %s\n", $1, $2, $3, $4, $5, $6, $7, $8, $9 }' "$RESULTS"
+
+if [ "$1" = "--baseline" ]; then
+	cp "$RESULTS" "$BASELINE"
+	echo "Saved baseline to $BASELINE"
+	exit 0
+fi
+
+if [ ! -f "$BASELINE" ]; then
+	echo "No baseline to compare against (run with --baseline to record one)"
+	exit 0
+fi
+
+#Compare throughput with the baseline, configuration by configuration
+awk -F, -v threshold="$THRESHOLD" '
+	FNR == 1 { next }
+	NR == FNR { baseline[$1 "," $2 "," $3 "," $4] = $5; next }
+	($1 "," $2 "," $3 "," $4) in baseline {
+		before = baseline[$1 "," $2 "," $3 "," $4]
+		if ( $5 < before * (1 - threshold / 100) ) {
+			printf "REGRESSION %s size %s buffer %s threads %s: %.1f MB/s (baseline %.1f MB/s)\n", $1, $2, $3, $4, $5, before
+			failed = 1
+		}
+	}
+	END {
+		if ( failed ) {
+			exit 1
+		}
+		print "No regressions beyond " threshold "% of the baseline"
+	}' "$BASELINE" "$RESULTS"
@@ -0,0 +1,109 @@
+/**
+	Checkpoint files for resumable runs.
+	
+	The file is plain text (one labelled line per field, histograms as written by histogramSave) and is replaced
+	atomically: it is written to a temporary file, synced and renamed over the old one, and the directory is synced so the
+	rename itself survives a crash. A crash at any point leaves either the previous checkpoint or the new one.
+*/
+
+//CLib imports
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "checkpoint.h"
+
+#define CHECKPOINT_VERSION 1
+
+static int syncDirectory(const char* path);
+
+//Write a checkpoint durably. Returns 0 on failure; the file then holds the previous checkpoint, or the new one not yet synced.
+int saveCheckpoint(const char* path, const checkpoint* c){
+	char* temp = (char*) malloc(strlen(path) + 5);
+	FILE* out;
+	int ok;
+	
+	if ( temp == NULL ) {
+		return 0;
+	}
+	sprintf(temp, "%s.tmp", path);
+	
+	out = fopen(temp, "w");
+	if ( out == NULL ) {
+		free(temp);
+		return 0;
+	}
+	
+	fprintf(out, "encrypt checkpoint %d\n", CHECKPOINT_VERSION);
+	fprintf(out, "offset %lld\n", c->offset);
+	fprintf(out, "s %d\n", c->s);
+	fprintf(out, "decrypt %d\n", c->decrypt);
+	fprintf(out, "input %lld %lld\n", c->inputSize, c->inputMtime);
+	histogramSave(out, "in", &c->inputCount);
+	histogramSave(out, "out", &c->outputCount);
+	
+	ok = fflush(out) == 0 && fsync(fileno(out)) == 0;
+	ok = (fclose(out) == 0) && ok;
+	ok = ok && rename(temp, path) == 0 && syncDirectory(path);
+	
+	if ( !ok ) {
+		unlink(temp);
+	}
+	
+	free(temp);
+	return ok;
+}
+
+//Read a checkpoint. Returns 0 if there is none or it isn't a valid one.
+int loadCheckpoint(const char* path, checkpoint* c){
+	FILE* in = fopen(path, "r");
+	int version = 0;
+	int ok;
+	
+	if ( in == NULL ) {
+		return 0;
+	}
+	
+	ok = fscanf(in, "encrypt checkpoint %d\n", &version) == 1 && version == CHECKPOINT_VERSION &&
+		fscanf(in, "offset %lld\n", &c->offset) == 1 &&
+		fscanf(in, "s %d\n", &c->s) == 1 &&
+		fscanf(in, "decrypt %d\n", &c->decrypt) == 1 &&
+		fscanf(in, "input %lld %lld\n", &c->inputSize, &c->inputMtime) == 2 &&
+		histogramLoad(in, "in", &c->inputCount) &&
+		histogramLoad(in, "out", &c->outputCount);
+	
+	fclose(in);
+	
+	return ok && c->offset >= 0 && (c->s == 1 || c->s == -1 || c->s == 0);
+}
+
+//Sync the directory holding path, which is what makes a rename into it durable. Returns 0 on failure.
+static int syncDirectory(const char* path){
+	char* directory = strdup(path);
+	char* slash;
+	int fd, ok;
+	
+	if ( directory == NULL ) {
+		return 0;
+	}
+	
+	//Keep the root's slash, and a bare name lives in the working directory
+	slash = strrchr(directory, '/');
+	if ( slash == NULL ) {
+		strcpy(directory, ".");
+	} else {
+		slash[slash == directory] = '\0';
+	}
+	
+	fd = open(directory, O_RDONLY | O_DIRECTORY);
+	ok = fd >= 0 && fsync(fd) == 0;
+	
+	if ( fd >= 0 ) {
+		close(fd);
+	}
+	
+	free(directory);
+	return ok;
+}
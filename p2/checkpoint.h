@@ -0,0 +1,27 @@
+/**
+	Checkpoint files for resumable runs (--checkpoint, --resume).
+	
+	A checkpoint records how far a run got: the input offset up to which the output is known to be on disk, the s value
+	to carry on from and both histograms for everything before that offset. It also records the input's size and
+	modification time and the direction, so a run is never resumed against different input or settings.
+*/
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "histogram.h"
+
+typedef struct {
+	long long offset; //Bytes of input processed (and of output synced)
+	int s; //s value for the character at offset
+	int decrypt; //If the run was decrypting
+	long long inputSize; //Input file identity
+	long long inputMtime;
+	histogram inputCount; //Counts of the first offset bytes of input and output
+	histogram outputCount;
+} checkpoint;
+
+int saveCheckpoint(const char* path, const checkpoint* c);
+int loadCheckpoint(const char* path, checkpoint* c);
+
+#endif
@@ -0,0 +1,346 @@
+/**
+	Scalar and vectorized versions of the encryption transform.
+	
+	The vector kernels classify 16 (SSE2) or 32 (AVX2) characters at a time as letters, take an in-register prefix count of
+	the letters to find each one's position in the +1/-1/0 cycle, and apply the shift and the 'A'/'Z'/'a'/'z' wraparound
+	with masks instead of branches. The kernel is picked once at runtime from the CPU features, falling back to scalar
+	off x86-64. The scalar kernel, which also finishes the vector kernels' tails, and isLetter() read the compile time
+	tables below.
+	
+	Decryption is the same walk through the cycle with the shifts swapped (-1 where encryption did +1 and the other way
+	round). Letters stay letters either way, so s advances identically, and every kernel takes a decrypt flag rather than
+	having a second copy.
+*/
+
+//CLib imports
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "cipher.h"
+
+#ifdef HAVE_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+/**
+	Encrypts characters with this methodology:
+		
+	1) s = 1;
+	2) Get next character c.
+	3) if c is not a letter then goto (7).
+	4) if (s==1) then increase c with wraparound (e.g., 'A' becomes 'B', 'c' becomes 'd', 'Z' becomes 'A', 'z' becomes 'a'), set s=-1, and goto (7).
+	5) if (s==-1) then decrease c with wraparound (e.g., 'B' becomes 'A', 'd' becomes 'c', 'A' becomes 'Z', 'a' becomes 'z'), set s=0, and goto (7).
+	6) if (s==0), then do not change c, and set s=1.
+	7) Encrypted character is c.
+
+*/
+char encrypt(char c, int* s){
+	int cVal = (int) c;
+	
+	if ( (cVal >= 65 && cVal <= 90) || (cVal >= 97 && cVal <= 122) ) {
+		//C is a letter
+		switch (*s) {
+			
+			//Decrease w/ wraparound
+			case -1:
+				*s = 0;
+				if (cVal == 65 ) {
+					cVal = 90;
+				} else if (cVal == 97 ) {
+					cVal = 122;
+				} else {
+					cVal = cVal - 1;
+				}
+				return (char) cVal;
+			
+			//Leave
+			case 0:
+				*s = 1;
+				return c;
+				
+			//Increase w/ wraparound
+			case 1:
+				*s = -1;
+				if ( cVal == 90 ) {
+					cVal = 65;
+				} else if ( cVal == 122 ) {
+					cVal = 97;
+				} else {
+					cVal = cVal + 1;
+				}
+				return (char) cVal;
+		}
+	} else {
+		return c;
+	}
+}
+
+//s value for each position in the cycle and back
+static const int cycleStates[3] = {1, -1, 0};
+
+static int stateIndex(int s){
+	return (s == 1) ? 0 : (s == -1) ? 1 : 2;
+}
+
+/*
+	Lookup tables for the transform, built entirely by the preprocessor so they are constant data in the binary. Each
+	entry is a constant expression of the byte value c (0-255), so the tables cost nothing at startup and can't drift
+	from the rules in encrypt(), which cipherTest checks them against for every byte and state.
+*/
+#define TABLE_IS_LETTER(c) ( ((c) >= 'A' && (c) <= 'Z') || ((c) >= 'a' && (c) <= 'z') )
+#define TABLE_UP(c) ( !TABLE_IS_LETTER(c) ? (c) : ((c) == 'Z') ? 'A' : ((c) == 'z') ? 'a' : (c) + 1 )
+#define TABLE_DOWN(c) ( !TABLE_IS_LETTER(c) ? (c) : ((c) == 'A') ? 'Z' : ((c) == 'a') ? 'z' : (c) - 1 )
+#define TABLE_SAME(c) (c)
+
+//The entry macro applied to all 256 byte values, 16 at a time
+#define TABLE_ROW16(f, b) (char) f((b) + 0), (char) f((b) + 1), (char) f((b) + 2), (char) f((b) + 3), \
+	(char) f((b) + 4), (char) f((b) + 5), (char) f((b) + 6), (char) f((b) + 7), \
+	(char) f((b) + 8), (char) f((b) + 9), (char) f((b) + 10), (char) f((b) + 11), \
+	(char) f((b) + 12), (char) f((b) + 13), (char) f((b) + 14), (char) f((b) + 15)
+#define TABLE_ROW256(f) TABLE_ROW16(f, 0), TABLE_ROW16(f, 16), TABLE_ROW16(f, 32), TABLE_ROW16(f, 48), \
+	TABLE_ROW16(f, 64), TABLE_ROW16(f, 80), TABLE_ROW16(f, 96), TABLE_ROW16(f, 112), \
+	TABLE_ROW16(f, 128), TABLE_ROW16(f, 144), TABLE_ROW16(f, 160), TABLE_ROW16(f, 176), \
+	TABLE_ROW16(f, 192), TABLE_ROW16(f, 208), TABLE_ROW16(f, 224), TABLE_ROW16(f, 240)
+
+_Static_assert(TABLE_UP('Z') == 'A' && TABLE_UP('z') == 'a' && TABLE_UP('m') == 'n', "increase wraps at Z/z");
+_Static_assert(TABLE_DOWN('A') == 'Z' && TABLE_DOWN('a') == 'z' && TABLE_DOWN('n') == 'm', "decrease wraps at A/a");
+_Static_assert(TABLE_UP('@') == '@' && TABLE_DOWN('[') == '[' && TABLE_UP(0xC1) == 0xC1, "non-letters pass through");
+
+//Encrypted character for each cycle position and byte value
+const char cipherTable[3][256] = {
+	{ TABLE_ROW256(TABLE_UP) },
+	{ TABLE_ROW256(TABLE_DOWN) },
+	{ TABLE_ROW256(TABLE_SAME) }
+};
+
+//Decrypted character for each cycle position and byte value
+const char decipherTable[3][256] = {
+	{ TABLE_ROW256(TABLE_DOWN) },
+	{ TABLE_ROW256(TABLE_UP) },
+	{ TABLE_ROW256(TABLE_SAME) }
+};
+
+//1 for letters, 0 for everything else
+const char letterTable[256] = { TABLE_ROW256(TABLE_IS_LETTER) };
+
+//Scalar kernel, one table lookup per character
+int encryptBlockScalar(char* data, int length, int index, int decrypt){
+	const char (*table)[256] = decrypt ? decipherTable : cipherTable;
+	int i;
+	
+	for(i = 0; i < length; i++ ) {
+		unsigned char c = (unsigned char) data[i];
+		
+		data[i] = table[index][c];
+		index += letterTable[c];
+		index = (index == 3) ? 0 : index;
+	}
+	
+	return index;
+}
+
+#ifdef HAVE_X86_KERNELS
+
+//Letter mask (0xFF for letters) of 16 characters. Folding to lowercase leaves only 'a'..'z' to test, done as one
+//unsigned range check by biasing into signed range.
+static inline __m128i letterMask128(__m128i v){
+	__m128i folded = _mm_or_si128(v, _mm_set1_epi8(0x20));
+	
+	return _mm_cmplt_epi8(_mm_add_epi8(folded, _mm_set1_epi8((char) (0x80 - 'a'))), _mm_set1_epi8((char) (-128 + 26)));
+}
+
+//Shift every letter by its cycle position with wraparound: +1 at upAt, -1 at downAt (0 and 1, swapped to decrypt) and
+//unchanged at 2
+static inline __m128i applyCycle128(__m128i v, __m128i letters, __m128i position, __m128i upAt, __m128i downAt){
+	__m128i folded = _mm_or_si128(v, _mm_set1_epi8(0x20));
+	__m128i up = _mm_and_si128(letters, _mm_cmpeq_epi8(position, upAt));
+	__m128i down = _mm_and_si128(letters, _mm_cmpeq_epi8(position, downAt));
+	__m128i wrapUp = _mm_and_si128(up, _mm_cmpeq_epi8(folded, _mm_set1_epi8('z')));
+	__m128i wrapDown = _mm_and_si128(down, _mm_cmpeq_epi8(folded, _mm_set1_epi8('a')));
+	
+	//up/down are -1 where set, so subtracting up adds one and adding down subtracts one
+	v = _mm_add_epi8(_mm_sub_epi8(v, up), down);
+	v = _mm_sub_epi8(v, _mm_and_si128(wrapUp, _mm_set1_epi8(26)));
+	v = _mm_add_epi8(v, _mm_and_si128(wrapDown, _mm_set1_epi8(26)));
+	
+	return v;
+}
+
+//Reduce each byte (at most 35) mod 3
+static inline __m128i mod3_128(__m128i x){
+	x = _mm_sub_epi8(x, _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8(23)), _mm_set1_epi8(24)));
+	x = _mm_sub_epi8(x, _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8(11)), _mm_set1_epi8(12)));
+	x = _mm_sub_epi8(x, _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8(5)), _mm_set1_epi8(6)));
+	x = _mm_sub_epi8(x, _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8(2)), _mm_set1_epi8(3)));
+	
+	return x;
+}
+
+//SSE2 kernel, 16 characters per step
+int encryptBlockSSE2(char* data, int length, int index, int decrypt){
+	__m128i upAt = _mm_set1_epi8((char) (decrypt ? 1 : 0));
+	__m128i downAt = _mm_set1_epi8((char) (decrypt ? 0 : 1));
+	int i = 0;
+	
+	for( ; i + 16 <= length; i += 16 ) {
+		__m128i v = _mm_loadu_si128((const __m128i*) (data + i));
+		__m128i letters = letterMask128(v);
+		__m128i ones = _mm_and_si128(letters, _mm_set1_epi8(1));
+		
+		//Inclusive prefix count of letters, then exclusive plus the starting position
+		__m128i prefix = ones;
+		prefix = _mm_add_epi8(prefix, _mm_slli_si128(prefix, 1));
+		prefix = _mm_add_epi8(prefix, _mm_slli_si128(prefix, 2));
+		prefix = _mm_add_epi8(prefix, _mm_slli_si128(prefix, 4));
+		prefix = _mm_add_epi8(prefix, _mm_slli_si128(prefix, 8));
+		prefix = _mm_add_epi8(_mm_sub_epi8(prefix, ones), _mm_set1_epi8((char) index));
+		
+		_mm_storeu_si128((__m128i*) (data + i), applyCycle128(v, letters, mod3_128(prefix), upAt, downAt));
+		
+		index = (index + __builtin_popcount(_mm_movemask_epi8(letters))) % 3;
+	}
+	
+	return encryptBlockScalar(data + i, length - i, index, decrypt);
+}
+
+//AVX2 versions of the helpers above
+__attribute__((target("avx2")))
+static inline __m256i letterMask256(__m256i v){
+	__m256i folded = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+	
+	return _mm256_cmpgt_epi8(_mm256_set1_epi8((char) (-128 + 26)), _mm256_add_epi8(folded, _mm256_set1_epi8((char) (0x80 - 'a'))));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i applyCycle256(__m256i v, __m256i letters, __m256i position, __m256i upAt, __m256i downAt){
+	__m256i folded = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+	__m256i up = _mm256_and_si256(letters, _mm256_cmpeq_epi8(position, upAt));
+	__m256i down = _mm256_and_si256(letters, _mm256_cmpeq_epi8(position, downAt));
+	__m256i wrapUp = _mm256_and_si256(up, _mm256_cmpeq_epi8(folded, _mm256_set1_epi8('z')));
+	__m256i wrapDown = _mm256_and_si256(down, _mm256_cmpeq_epi8(folded, _mm256_set1_epi8('a')));
+	
+	v = _mm256_add_epi8(_mm256_sub_epi8(v, up), down);
+	v = _mm256_sub_epi8(v, _mm256_and_si256(wrapUp, _mm256_set1_epi8(26)));
+	v = _mm256_add_epi8(v, _mm256_and_si256(wrapDown, _mm256_set1_epi8(26)));
+	
+	return v;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i mod3_256(__m256i x){
+	x = _mm256_sub_epi8(x, _mm256_and_si256(_mm256_cmpgt_epi8(x, _mm256_set1_epi8(23)), _mm256_set1_epi8(24)));
+	x = _mm256_sub_epi8(x, _mm256_and_si256(_mm256_cmpgt_epi8(x, _mm256_set1_epi8(11)), _mm256_set1_epi8(12)));
+	x = _mm256_sub_epi8(x, _mm256_and_si256(_mm256_cmpgt_epi8(x, _mm256_set1_epi8(5)), _mm256_set1_epi8(6)));
+	x = _mm256_sub_epi8(x, _mm256_and_si256(_mm256_cmpgt_epi8(x, _mm256_set1_epi8(2)), _mm256_set1_epi8(3)));
+	
+	return x;
+}
+
+//AVX2 kernel, 32 characters per step. Byte shifts stay within each 128 bit lane, so the low lane's letter total is
+//added to the high lane separately.
+__attribute__((target("avx2")))
+int encryptBlockAVX2(char* data, int length, int index, int decrypt){
+	__m256i upAt = _mm256_set1_epi8((char) (decrypt ? 1 : 0));
+	__m256i downAt = _mm256_set1_epi8((char) (decrypt ? 0 : 1));
+	int i = 0;
+	
+	for( ; i + 32 <= length; i += 32 ) {
+		__m256i v = _mm256_loadu_si256((const __m256i*) (data + i));
+		__m256i letters = letterMask256(v);
+		__m256i ones = _mm256_and_si256(letters, _mm256_set1_epi8(1));
+		unsigned int mask = (unsigned int) _mm256_movemask_epi8(letters);
+		
+		__m256i prefix = ones;
+		prefix = _mm256_add_epi8(prefix, _mm256_slli_si256(prefix, 1));
+		prefix = _mm256_add_epi8(prefix, _mm256_slli_si256(prefix, 2));
+		prefix = _mm256_add_epi8(prefix, _mm256_slli_si256(prefix, 4));
+		prefix = _mm256_add_epi8(prefix, _mm256_slli_si256(prefix, 8));
+		prefix = _mm256_add_epi8(prefix, _mm256_set_m128i(_mm_set1_epi8((char) __builtin_popcount(mask & 0xFFFF)), _mm_setzero_si128()));
+		prefix = _mm256_add_epi8(_mm256_sub_epi8(prefix, ones), _mm256_set1_epi8((char) index));
+		
+		_mm256_storeu_si256((__m256i*) (data + i), applyCycle256(v, letters, mod3_256(prefix), upAt, downAt));
+		
+		index = (index + __builtin_popcount(mask)) % 3;
+	}
+	
+	return encryptBlockSSE2(data + i, length - i, index, decrypt);
+}
+
+//If the CPU (and OS) support AVX2
+int cpuHasAVX2(void){
+	__builtin_cpu_init();
+	
+	return __builtin_cpu_supports("avx2");
+}
+
+//Letters in a block, 16 characters per step
+static long countLettersSSE2(const char* data, int length){
+	long letters = 0;
+	int i = 0;
+	
+	for( ; i + 16 <= length; i += 16 ) {
+		letters += __builtin_popcount(_mm_movemask_epi8(letterMask128(_mm_loadu_si128((const __m128i*) (data + i)))));
+	}
+	
+	for( ; i < length; i++ ) {
+		letters += letterTable[(unsigned char) data[i]];
+	}
+	
+	return letters;
+}
+
+#endif
+
+//Kernel used by encryptBlock, picked on first use
+static blockKernel kernel = NULL;
+static pthread_once_t kernelOnce = PTHREAD_ONCE_INIT;
+
+static void pickKernel(){
+#ifdef HAVE_X86_KERNELS
+	//SSE2 is part of the x86-64 baseline
+	kernel = cpuHasAVX2() ? encryptBlockAVX2 : encryptBlockSSE2;
+#else
+	kernel = encryptBlockScalar;
+#endif
+}
+
+//Encrypts a block in place with the fastest available kernel, carrying s in and out like encrypt()
+void encryptBlock(char* data, int length, int* s){
+	pthread_once(&kernelOnce, pickKernel);
+	
+	*s = cycleStates[kernel(data, length, stateIndex(*s), 0)];
+}
+
+//Reverses encryptBlock, given the same s the block was encrypted from
+void decryptBlock(char* data, int length, int* s){
+	pthread_once(&kernelOnce, pickKernel);
+	
+	*s = cycleStates[kernel(data, length, stateIndex(*s), 1)];
+}
+
+//Number of letters in a block
+long countLetters(const char* data, int length){
+#ifdef HAVE_X86_KERNELS
+	return countLettersSSE2(data, length);
+#else
+	long letters = 0;
+	int i;
+	
+	for(i = 0; i < length; i++ ) {
+		letters += letterTable[(unsigned char) data[i]];
+	}
+	
+	return letters;
+#endif
+}
+
+//If c is a letter (the only characters that advance s)
+int isLetter(char c){
+	return letterTable[(unsigned char) c];
+}
+
+//The s value after encrypting the given number of letters starting from s (1 -> -1 -> 0 -> 1 ...)
+int advanceState(int s, long letters){
+	return cycleStates[(stateIndex(s) + letters) % 3];
+}
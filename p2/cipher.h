@@ -0,0 +1,40 @@
+/**
+	The encryption transform used by the encrypt pipeline.
+	
+	encrypt() is the original one character at a time state machine and stays the reference for everything else here.
+	encryptBlock() applies the same transform to a whole block, using an SSE2 or AVX2 kernel when the CPU has one.
+	decryptBlock() undoes encryptBlock(). cipherTable, decipherTable and letterTable hold the transform and its inverse
+	precomputed for every byte value.
+*/
+
+#ifndef CIPHER_H
+#define CIPHER_H
+
+//Kernel signature. index is the position in the +1/-1/0 cycle (0 for s=1, 1 for s=-1, 2 for s=0) at the first
+//character; the position after the last character is returned. decrypt runs the cycle backwards (-1/+1/0).
+typedef int (*blockKernel)(char* data, int length, int index, int decrypt);
+
+//Encrypted and decrypted character by cycle position and (unsigned) byte value, and 1 for letters
+extern const char cipherTable[3][256];
+extern const char decipherTable[3][256];
+extern const char letterTable[256];
+
+char encrypt(char c, int* s);
+int isLetter(char c);
+int advanceState(int s, long letters);
+
+void encryptBlock(char* data, int length, int* s);
+void decryptBlock(char* data, int length, int* s);
+long countLetters(const char* data, int length);
+
+//Individual kernels, exposed for testing
+int encryptBlockScalar(char* data, int length, int index, int decrypt);
+
+#if defined(__x86_64__)
+#define HAVE_X86_KERNELS 1
+int encryptBlockSSE2(char* data, int length, int index, int decrypt);
+int encryptBlockAVX2(char* data, int length, int index, int decrypt); //Only call when cpuHasAVX2()
+int cpuHasAVX2(void);
+#endif
+
+#endif
@@ -0,0 +1,157 @@
+/**
+	Checks the lookup tables and block kernels in cipher.c byte for byte against the original encrypt().
+	
+	Every kernel is run over random buffers (all 256 byte values, and letter heavy text around the wraparound characters)
+	at every starting s and a range of lengths and alignments, and must match encrypt() applied one character at a time
+	in both the output and the final s. Decrypting with every kernel must then give back the original input (the round
+	trip property decrypt(encrypt(x)) == x).
+*/
+
+//CLib imports
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cipher.h"
+
+#define MAX_LENGTH 300
+
+int failures = 0;
+
+//Fill a buffer with random bytes, or with characters biased towards letters and 'A'/'Z'/'a'/'z'
+void fillRandom(char* data, int length, int letterHeavy){
+	static const char alphabet[] = "AZazAZazbcYyMm \n.09@[`{";
+	int i;
+	
+	for(i = 0; i < length; i++ ) {
+		if ( letterHeavy ) {
+			data[i] = alphabet[rand() % (sizeof(alphabet) - 1)];
+		} else {
+			data[i] = (char) (rand() & 0xFF);
+		}
+	}
+}
+
+//Run one kernel against the oracle on a copy of the input
+void checkKernel(const char* name, blockKernel kernel, const char* input, int length, int s){
+	static const int states[3] = {1, -1, 0};
+	char expected[MAX_LENGTH + 32];
+	char actual[MAX_LENGTH + 32];
+	int expectedS = s;
+	int index;
+	int i;
+	
+	memcpy(expected, input, length);
+	memcpy(actual + 1, input, length); //Misaligned on purpose
+	
+	for(i = 0; i < length; i++ ) {
+		expected[i] = encrypt(expected[i], &expectedS);
+	}
+	
+	index = kernel(actual + 1, length, (s == 1) ? 0 : (s == -1) ? 1 : 2, 0);
+	
+	if ( memcmp(expected, actual + 1, length) != 0 || states[index] != expectedS ) {
+		printf("FAIL %s: length %d, s %d\n", name, length, s);
+		failures++;
+	}
+}
+
+//Encrypt with one kernel and decrypt with another from the same s, which must restore the input
+void checkRoundTrip(const char* name, blockKernel encryptKernel, blockKernel decryptKernel, const char* input, int length, int s){
+	char data[MAX_LENGTH + 32];
+	int index = (s == 1) ? 0 : (s == -1) ? 1 : 2;
+	
+	memcpy(data + 3, input, length); //Misaligned on purpose
+	
+	if ( encryptKernel(data + 3, length, index, 0) != decryptKernel(data + 3, length, index, 1) || memcmp(data + 3, input, length) != 0 ) {
+		printf("FAIL %s round trip: length %d, s %d\n", name, length, s);
+		failures++;
+	}
+}
+
+int main(int argc, char** argv) {
+	char input[MAX_LENGTH];
+	int length, s, round, letterHeavy;
+	char all[256];
+	int i, allS;
+	
+	srand(352);
+	
+	for(round = 0; round < 200; round++ ) {
+		for(length = 0; length <= MAX_LENGTH; length += (length < 70) ? 1 : 23 ) {
+			for(letterHeavy = 0; letterHeavy < 2; letterHeavy++ ) {
+				fillRandom(input, length, letterHeavy);
+				
+				for(s = -1; s <= 1; s++ ) {
+					checkKernel("scalar", encryptBlockScalar, input, length, s);
+#ifdef HAVE_X86_KERNELS
+					checkKernel("sse2", encryptBlockSSE2, input, length, s);
+					if ( cpuHasAVX2() ) {
+						checkKernel("avx2", encryptBlockAVX2, input, length, s);
+					}
+#endif
+					
+					checkRoundTrip("scalar", encryptBlockScalar, encryptBlockScalar, input, length, s);
+#ifdef HAVE_X86_KERNELS
+					checkRoundTrip("sse2", encryptBlockSSE2, encryptBlockSSE2, input, length, s);
+					checkRoundTrip("sse2/scalar", encryptBlockSSE2, encryptBlockScalar, input, length, s);
+					if ( cpuHasAVX2() ) {
+						checkRoundTrip("avx2", encryptBlockAVX2, encryptBlockAVX2, input, length, s);
+						checkRoundTrip("scalar/avx2", encryptBlockScalar, encryptBlockAVX2, input, length, s);
+					}
+#endif
+				}
+			}
+		}
+	}
+	
+	//Lookup tables against encrypt() for every byte value and cycle position
+	for(i = 0; i < 256; i++ ) {
+		for(s = -1; s <= 1; s++ ) {
+			int index = (s == 1) ? 0 : (s == -1) ? 1 : 2;
+			int nextS = s;
+			char expected = encrypt((char) i, &nextS);
+			
+			if ( cipherTable[index][i] != expected || letterTable[i] != (nextS != s) ||
+				decipherTable[index][(unsigned char) expected] != (char) i ) {
+				printf("FAIL tables: byte %d, s %d\n", i, s);
+				failures++;
+			}
+		}
+	}
+	
+	//encryptBlock and countLetters on every byte value
+	for(i = 0; i < 256; i++ ) {
+		all[i] = (char) i;
+	}
+	
+	if ( countLetters(all, 256) != 52 ) {
+		printf("FAIL countLetters: %ld letters in all byte values\n", countLetters(all, 256));
+		failures++;
+	}
+	
+	allS = 1;
+	encryptBlock(all, 256, &allS);
+	if ( allS != advanceState(1, 52) ) {
+		printf("FAIL encryptBlock: final s %d\n", allS);
+		failures++;
+	}
+	
+	allS = 1;
+	decryptBlock(all, 256, &allS);
+	for(i = 0; i < 256; i++ ) {
+		if ( all[i] != (char) i ) {
+			printf("FAIL decryptBlock: byte %d\n", i);
+			failures++;
+			break;
+		}
+	}
+	
+	if ( failures ) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	
+	printf("All cipher kernels match encrypt() and decrypt back\n");
+	return 0;
+}
@@ -0,0 +1,296 @@
+/**
+	Server mode for the encrypt program (--serve).
+	
+	The main thread accepts connections and queues them; a fixed pool of workers takes them in arrival order. Each worker
+	allocates its block buffer and encryption context once at startup and reuses them for every job. Path jobs run the
+	same single pass as --batch; data jobs encrypt each frame as it arrives and send it straight back, so memory stays
+	bounded whatever the payload size.
+	
+	Path jobs read and write files with the server's permissions, so the socket is created owner only and every peer's
+	credentials are checked against the server's own user before its job runs.
+*/
+
+#define _GNU_SOURCE
+
+//CLib imports
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+
+#include "daemon.h"
+#include "batch.h"
+#include "encryptlib.h"
+
+//Connections accepted but not yet taken by a worker
+#define DAEMON_BACKLOG 64
+
+//Accepted connections waiting for a worker
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t notEmpty;
+	pthread_cond_t notFull;
+	int fds[DAEMON_BACKLOG];
+	int head;
+	int count;
+	int blockSize;
+} daemonQueue;
+
+static const char* listeningPath;
+
+static void* daemonWorker(void* args);
+static void runJob(int fd, encrypt_context* ctx, char* buffer, int blockSize);
+static int runStream(FILE* in, int fd, encrypt_context* ctx, char* buffer);
+static void reply(int fd, encrypt_context* ctx);
+static void replyError(int fd, const char* reason);
+static int peerAllowed(int fd);
+static int readLine(FILE* in, char** line, size_t* size);
+static void stopDaemon(int signal);
+
+/**
+	Listens on socketPath and serves jobs until interrupted. Returns 0 if the socket can't be set up (including when
+	another server is already listening there).
+*/
+int runDaemon(const char* socketPath, int workers, int blockSize){
+	struct sockaddr_un address;
+	struct stat info;
+	daemonQueue queue;
+	pthread_t* threads;
+	mode_t mask;
+	int listener, fd, i, bound;
+	
+	if ( strlen(socketPath) >= sizeof(address.sun_path) ) {
+		printf("Socket path is too long \n");
+		return 0;
+	}
+	
+	//A socket file nobody answers on is left over from a server that died
+	fd = daemonConnect(socketPath);
+	if ( fd >= 0 ) {
+		close(fd);
+		printf("A server is already listening on %s \n", socketPath);
+		return 0;
+	}
+	
+	//Only ever remove a stale socket, never whatever else the path names
+	if ( lstat(socketPath, &info) == 0 ) {
+		if ( !S_ISSOCK(info.st_mode) ) {
+			printf("%s exists and is not a socket \n", socketPath);
+			return 0;
+		}
+		
+		unlink(socketPath);
+	}
+	
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, socketPath);
+	
+	//bind creates the socket file, and its mode comes from the umask, so no other user can ever connect (mode 0600)
+	listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	mask = umask(0177);
+	bound = listener >= 0 && bind(listener, (struct sockaddr*) &address, sizeof(address)) == 0;
+	umask(mask);
+	
+	if ( !bound || listen(listener, DAEMON_BACKLOG) < 0 ) {
+		printf("Could not listen on %s \n", socketPath);
+		return 0;
+	}
+	
+	//Clients that hang up mid reply must not take the server down, and an interrupt removes the socket
+	listeningPath = socketPath;
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, stopDaemon);
+	signal(SIGTERM, stopDaemon);
+	
+	pthread_mutex_init(&queue.lock, NULL);
+	pthread_cond_init(&queue.notEmpty, NULL);
+	pthread_cond_init(&queue.notFull, NULL);
+	queue.head = 0;
+	queue.count = 0;
+	queue.blockSize = blockSize < DAEMON_FRAME ? DAEMON_FRAME : blockSize;
+	
+	threads = (pthread_t*) malloc(sizeof(pthread_t) * workers);
+	for(i = 0; i < workers; i++ ) {
+		pthread_create(&threads[i], NULL, daemonWorker, &queue);
+	}
+	
+	fprintf(stderr, "Listening on %s with %d workers \n", socketPath, workers);
+	
+	while ( 1 ) {
+		fd = accept(listener, NULL, NULL);
+		if ( fd < 0 ) {
+			continue;
+		}
+		
+		pthread_mutex_lock(&queue.lock);
+		while ( queue.count == DAEMON_BACKLOG ) {
+			pthread_cond_wait(&queue.notFull, &queue.lock);
+		}
+		queue.fds[(queue.head + queue.count) % DAEMON_BACKLOG] = fd;
+		queue.count++;
+		pthread_cond_signal(&queue.notEmpty);
+		pthread_mutex_unlock(&queue.lock);
+	}
+	
+	return 1;
+}
+
+//Worker thread: buffer and context are set up once, then every queued connection is run as a job
+static void* daemonWorker(void* args){
+	daemonQueue* queue = (daemonQueue*) args;
+	encrypt_context* ctx = encrypt_create();
+	char* buffer = (char*) malloc(queue->blockSize);
+	int fd;
+	
+	while ( 1 ) {
+		pthread_mutex_lock(&queue->lock);
+		while ( queue->count == 0 ) {
+			pthread_cond_wait(&queue->notEmpty, &queue->lock);
+		}
+		fd = queue->fds[queue->head];
+		queue->head = (queue->head + 1) % DAEMON_BACKLOG;
+		queue->count--;
+		pthread_cond_signal(&queue->notFull);
+		pthread_mutex_unlock(&queue->lock);
+		
+		if ( !peerAllowed(fd) ) {
+			replyError(fd, "permission denied");
+		} else if ( ctx == NULL || buffer == NULL ) {
+			replyError(fd, "out of memory");
+		} else {
+			runJob(fd, ctx, buffer, queue->blockSize);
+		}
+		
+		close(fd);
+	}
+	
+	return (void*) NULL;
+}
+
+//Only processes running as the same user as the server may submit jobs
+static int peerAllowed(int fd){
+	struct ucred credentials;
+	socklen_t length = sizeof(credentials);
+	
+	return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &length) == 0 && credentials.uid == geteuid();
+}
+
+//Read a request and run it
+static void runJob(int fd, encrypt_context* ctx, char* buffer, int blockSize){
+	FILE* in = fdopen(dup(fd), "r");
+	char* command = NULL;
+	char* input = NULL;
+	char* output = NULL;
+	size_t commandSize = 0, inputSize = 0, outputSize = 0;
+	
+	if ( in == NULL || !readLine(in, &command, &commandSize) ) {
+		replyError(fd, "no request");
+	} else if ( strcmp(command, "encrypt path") == 0 || strcmp(command, "decrypt path") == 0 ) {
+		encrypt_set_decrypt(ctx, command[0] == 'd');
+		
+		if ( !readLine(in, &input, &inputSize) || !readLine(in, &output, &outputSize) || input[0] != '/' || output[0] != '/' ) {
+			replyError(fd, "path jobs need an absolute input and output path");
+		} else if ( !encryptPath(ctx, input, output, buffer, blockSize) ) {
+			replyError(fd, "could not encrypt the file");
+		} else {
+			reply(fd, ctx);
+		}
+	} else if ( strcmp(command, "encrypt data") == 0 || strcmp(command, "decrypt data") == 0 ) {
+		encrypt_set_decrypt(ctx, command[0] == 'd');
+		
+		if ( runStream(in, fd, ctx, buffer) ) {
+			reply(fd, ctx);
+		} else {
+			replyError(fd, "bad frame");
+		}
+	} else {
+		replyError(fd, "unknown request");
+	}
+	
+	if ( in != NULL ) {
+		fclose(in);
+	}
+	
+	free(command);
+	free(input);
+	free(output);
+}
+
+//Encrypt frames as they arrive, sending each one back before reading the next. Returns 0 on a protocol error.
+static int runStream(FILE* in, int fd, encrypt_context* ctx, char* buffer){
+	uint32_t length;
+	size_t sent;
+	ssize_t written;
+	
+	encrypt_reset(ctx);
+	
+	while ( fread(&length, sizeof(length), 1, in) == 1 && length <= DAEMON_FRAME ) {
+		if ( length == 0 ) {
+			encrypt_finish(ctx);
+			return 1;
+		}
+		
+		if ( fread(buffer, 1, length, in) != length ) {
+			return 0;
+		}
+		
+		encrypt_update(ctx, buffer, buffer, length);
+		
+		for(sent = 0; sent < length; sent += written ) {
+			written = write(fd, buffer + sent, length - sent);
+			if ( written <= 0 ) {
+				return 0;
+			}
+		}
+	}
+	
+	return 0;
+}
+
+//Send the counts of a finished job
+static void reply(int fd, encrypt_context* ctx){
+	FILE* out = fdopen(dup(fd), "w");
+	histogram counts;
+	
+	if ( out == NULL ) {
+		return;
+	}
+	
+	fprintf(out, "ok\n");
+	memcpy(counts.counts, encrypt_input_counts(ctx), sizeof(counts.counts));
+	histogramSave(out, "in", &counts);
+	memcpy(counts.counts, encrypt_output_counts(ctx), sizeof(counts.counts));
+	histogramSave(out, "out", &counts);
+	fclose(out);
+}
+
+static void replyError(int fd, const char* reason){
+	dprintf(fd, "error %s\n", reason);
+}
+
+//Read one line without its newline. Returns 0 at end of input.
+static int readLine(FILE* in, char** line, size_t* size){
+	ssize_t length = getline(line, size, in);
+	
+	if ( length <= 0 ) {
+		return 0;
+	}
+	
+	if ( (*line)[length - 1] == '\n' ) {
+		(*line)[length - 1] = '\0';
+	}
+	
+	return 1;
+}
+
+static void stopDaemon(int signal){
+	unlink(listeningPath);
+	_exit(0);
+}
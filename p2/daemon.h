@@ -0,0 +1,40 @@
+/**
+	Server mode for the encrypt program (--serve) and the client side of its protocol.
+	
+	The server listens on a Unix domain socket and runs each connection as one job on a pool of worker threads that keep
+	their buffers and encryption contexts between jobs, so a request pays for none of the process, thread or buffer setup
+	of a cold run. A job either names files for the server to read and write itself, or streams the data inline.
+	
+	Protocol (one job per connection):
+		request:  "encrypt path\n" or "decrypt path\n", then the absolute input and output paths, one per line
+		      or: "encrypt data\n" or "decrypt data\n", then frames of a 4 byte length (native order, at most
+		          DAEMON_FRAME) and that many bytes, ended by a zero length
+		response: for data jobs, each frame's bytes transformed, sent as soon as the frame is processed; then
+		          "ok\n" and the input and output histograms (histogramSave lines "in" and "out"), or "error <reason>\n"
+	
+	The socket file is mode 0600 and connections from any other user get "error permission denied".
+*/
+
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stdio.h>
+
+#include "histogram.h"
+
+//Socket used when none is given (clients also look at ENCRYPT_SOCKET)
+#define DEFAULT_SOCKET "/tmp/encrypt.sock"
+
+//Largest inline frame. Small enough that a frame and its reply both fit in the socket buffers, so a client can send one
+//frame and then read its reply without either side stalling.
+#define DAEMON_FRAME 65536
+
+//Server
+int runDaemon(const char* socketPath, int workers, int blockSize);
+
+//Client
+int daemonConnect(const char* socketPath);
+int daemonEncryptPath(int fd, int decrypt, const char* input, const char* output, histogram* inputCount, histogram* outputCount);
+int daemonEncryptStream(int fd, int decrypt, FILE* input, FILE* output, histogram* inputCount, histogram* outputCount);
+
+#endif
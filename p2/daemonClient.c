@@ -0,0 +1,145 @@
+/**
+	Client side of the encrypt daemon protocol (see daemon.h), shared by encryptClient and the latency benchmark.
+	
+	Each call runs one job on an already connected socket and closes it. Errors reported by the server are printed to
+	stderr.
+*/
+
+//CLib imports
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "daemon.h"
+
+static int writeFully(int fd, const char* data, size_t length);
+static int readFully(int fd, char* data, size_t length);
+static int readResult(int fd, histogram* inputCount, histogram* outputCount);
+
+//Connect to a running server. Returns the socket, or -1 if nothing is listening there.
+int daemonConnect(const char* socketPath){
+	struct sockaddr_un address;
+	int fd;
+	
+	if ( strlen(socketPath) >= sizeof(address.sun_path) ) {
+		return -1;
+	}
+	
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, socketPath);
+	
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if ( fd < 0 ) {
+		return -1;
+	}
+	
+	if ( connect(fd, (struct sockaddr*) &address, sizeof(address)) < 0 ) {
+		close(fd);
+		return -1;
+	}
+	
+	return fd;
+}
+
+//Have the server encrypt one file into another itself (both paths absolute). Returns 0 on failure.
+int daemonEncryptPath(int fd, int decrypt, const char* input, const char* output, histogram* inputCount, histogram* outputCount){
+	char* request = (char*) malloc(strlen(input) + strlen(output) + 32);
+	int ok;
+	
+	if ( request == NULL ) {
+		close(fd);
+		return 0;
+	}
+	
+	sprintf(request, "%s path\n%s\n%s\n", decrypt ? "decrypt" : "encrypt", input, output);
+	//A server that turns the job down may hang up before reading it, but its reason is still waiting to be read
+	ok = writeFully(fd, request, strlen(request));
+	ok = readResult(fd, inputCount, outputCount) && ok;
+	
+	free(request);
+	return ok;
+}
+
+//Stream a file through the server a frame at a time, writing what comes back. Returns 0 on failure.
+int daemonEncryptStream(int fd, int decrypt, FILE* input, FILE* output, histogram* inputCount, histogram* outputCount){
+	char* frame = (char*) malloc(DAEMON_FRAME);
+	const char* request = decrypt ? "decrypt data\n" : "encrypt data\n";
+	uint32_t length;
+	int ok;
+	
+	if ( frame == NULL ) {
+		close(fd);
+		return 0;
+	}
+	
+	ok = writeFully(fd, request, strlen(request));
+	
+	do {
+		length = (uint32_t) fread(frame, 1, DAEMON_FRAME, input);
+		
+		ok = ok && writeFully(fd, (const char*) &length, sizeof(length)) && writeFully(fd, frame, length);
+		ok = ok && readFully(fd, frame, length) && fwrite(frame, 1, length, output) == length;
+	} while ( ok && length > 0 );
+	
+	free(frame);
+	return readResult(fd, inputCount, outputCount) && ok;
+}
+
+//Read the server's verdict and histograms, then close the socket
+static int readResult(int fd, histogram* inputCount, histogram* outputCount){
+	FILE* in = fdopen(fd, "r");
+	char status[256] = "";
+	int ok;
+	
+	if ( in == NULL ) {
+		close(fd);
+		return 0;
+	}
+	
+	ok = fgets(status, sizeof(status), in) != NULL && strcmp(status, "ok\n") == 0 &&
+		histogramLoad(in, "in", inputCount) && histogramLoad(in, "out", outputCount);
+	
+	if ( !ok ) {
+		fprintf(stderr, "Encrypt daemon: %s", strncmp(status, "error ", 6) == 0 ? status + 6 : "no reply \n");
+	}
+	
+	fclose(in);
+	return ok;
+}
+
+static int writeFully(int fd, const char* data, size_t length){
+	ssize_t written;
+	
+	while ( length > 0 ) {
+		written = send(fd, data, length, MSG_NOSIGNAL); //A closed connection is an error here, not a SIGPIPE
+		if ( written <= 0 ) {
+			return 0;
+		}
+		
+		data += written;
+		length -= written;
+	}
+	
+	return 1;
+}
+
+static int readFully(int fd, char* data, size_t length){
+	ssize_t got;
+	
+	while ( length > 0 ) {
+		got = read(fd, data, length);
+		if ( got <= 0 ) {
+			return 0;
+		}
+		
+		data += got;
+		length -= got;
+	}
+	
+	return 1;
+}
@@ -0,0 +1,133 @@
+/**
+	Client for the encrypt daemon (encrypt --serve). Takes the same file arguments as encrypt and prints the same counts,
+	but has a running server do the work, so nothing is set up per file.
+	
+	Regular files are sent as paths and the server reads and writes them itself; stdin/stdout (-), or any file with
+	--inline, are streamed through the socket instead.
+	
+	Usage: ./encryptClient [--socket path] [--decrypt] [--inline] inputfile|- outputfile|-
+*/
+
+//CLib imports
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <getopt.h>
+
+#include "daemon.h"
+#include "histogram.h"
+
+char* absolutePath(const char* path);
+
+int main(int argc, char** argv) {
+	static struct option longOptions[] = {
+		{"socket", required_argument, NULL, 'S'},
+		{"decrypt", no_argument, NULL, 'D'},
+		{"inline", no_argument, NULL, 'N'},
+		{NULL, 0, NULL, 0}
+	};
+	char* socketPath = getenv("ENCRYPT_SOCKET") != NULL ? getenv("ENCRYPT_SOCKET") : DEFAULT_SOCKET;
+	int decrypt = 0;
+	int inlineData = 0;
+	histogram inputCount, outputCount;
+	FILE* input;
+	FILE* output;
+	FILE* countsOut = stdout;
+	char* inputPath;
+	char* outputPath;
+	int opt, fd, ok;
+	
+	while ( (opt = getopt_long(argc, argv, "", longOptions, NULL)) != -1 ) {
+		switch ( opt ) {
+			case 'S':
+				socketPath = optarg;
+				break;
+			case 'D':
+				decrypt = 1;
+				break;
+			case 'N':
+				inlineData = 1;
+				break;
+			default:
+				argc = 0;
+		}
+	}
+	
+	if ( argc - optind != 2 ) {
+		printf("Incorrect format. Should be: ./encryptClient [--socket path] [--decrypt] [--inline] inputfile|- outputfile|- \n");
+		return 1;
+	}
+	
+	fd = daemonConnect(socketPath);
+	if ( fd < 0 ) {
+		printf("No encrypt daemon listening on %s \n", socketPath);
+		return 1;
+	}
+	
+	if ( strcmp(argv[optind], "-") == 0 || strcmp(argv[optind + 1], "-") == 0 ) {
+		inlineData = 1;
+	}
+	
+	if ( inlineData ) {
+		input = (strcmp(argv[optind], "-") == 0) ? stdin : fopen(argv[optind], "r");
+		output = (strcmp(argv[optind + 1], "-") == 0) ? stdout : fopen(argv[optind + 1], "w");
+		
+		if ( input == NULL || output == NULL ) {
+			printf("Could not open files \n");
+			return 1;
+		}
+		
+		//Keep the counts out of a data stream on stdout
+		if ( output == stdout ) {
+			countsOut = stderr;
+		}
+		
+		ok = daemonEncryptStream(fd, decrypt, input, output, &inputCount, &outputCount);
+		ok = (fflush(output) == 0) && ok;
+	} else {
+		inputPath = absolutePath(argv[optind]);
+		outputPath = absolutePath(argv[optind + 1]);
+		
+		if ( inputPath == NULL || outputPath == NULL ) {
+			printf("Input file doesn't exist \n");
+			return 1;
+		}
+		
+		ok = daemonEncryptPath(fd, decrypt, inputPath, outputPath, &inputCount, &outputCount);
+		
+		free(inputPath);
+		free(outputPath);
+	}
+	
+	if ( !ok ) {
+		return 1;
+	}
+	
+	histogramPrint(countsOut, "Input Counts:", &inputCount);
+	histogramPrint(countsOut, "Output Counts:", &outputCount);
+	
+	return 0;
+}
+
+//The path as the server will see it: resolved relative to our working directory (the output need not exist yet)
+char* absolutePath(const char* path){
+	char cwd[PATH_MAX];
+	char* result;
+	
+	if ( path[0] == '/' ) {
+		return strdup(path);
+	}
+	
+	if ( getcwd(cwd, sizeof(cwd)) == NULL ) {
+		return NULL;
+	}
+	
+	result = (char*) malloc(strlen(cwd) + strlen(path) + 2);
+	if ( result != NULL ) {
+		sprintf(result, "%s/%s", cwd, path);
+	}
+	
+	return result;
+}
@@ -0,0 +1,128 @@
+/**
+	Embeddable interface to the encryption engine.
+	
+	encrypt_update runs the same fused pass as --fused: each ENCRYPT_CHUNK piece is copied to the output, counted,
+	encrypted in place and counted again while it is still in L1. The counts collect in the context's pending
+	sub-histograms and are only folded into the 64 bit counters by encrypt_finish and the count accessors. The transform
+	and counting engines (cipher.c and histogram.c) keep no per call state, so contexts are fully independent.
+*/
+
+//CLib imports
+#include <stdlib.h>
+#include <string.h>
+
+#include "encryptlib.h"
+#include "cipher.h"
+#include "histogram.h"
+
+//Bytes taken through count, encrypt and count before moving on
+#define ENCRYPT_CHUNK 8192
+
+struct encrypt_context {
+	int s; //s value for the next character
+	int finished; //encrypt_finish has been called
+	int decrypt; //Undo the transform instead (kept across resets)
+	unsigned long long total; //Bytes processed
+	histogram inputCount;
+	histogram outputCount;
+	histogramPending inputPending; //Counted but not yet folded into inputCount
+	histogramPending outputPending;
+};
+
+//New context, ready for input. Returns NULL if out of memory.
+encrypt_context* encrypt_create(void){
+	encrypt_context* ctx = (encrypt_context*) malloc(sizeof(encrypt_context));
+	
+	if ( ctx != NULL ) {
+		ctx->decrypt = 0;
+		encrypt_reset(ctx);
+	}
+	
+	return ctx;
+}
+
+void encrypt_destroy(encrypt_context* ctx){
+	free(ctx);
+}
+
+//Start a new stream: s back to 1 and empty histograms
+void encrypt_reset(encrypt_context* ctx){
+	ctx->s = 1;
+	ctx->finished = 0;
+	ctx->total = 0;
+	histogramClear(&ctx->inputCount);
+	histogramClear(&ctx->outputCount);
+	histogramPendingClear(&ctx->inputPending);
+	histogramPendingClear(&ctx->outputPending);
+}
+
+//Switch the context between encrypting (0) and decrypting (1). Takes effect for the next stream, so call before any input.
+void encrypt_set_decrypt(encrypt_context* ctx, int decrypt){
+	ctx->decrypt = decrypt;
+}
+
+//Encrypt a whole input on its own (resets the context first, the histograms describe just this input afterwards)
+int encrypt_buffer(encrypt_context* ctx, const char* in, char* out, size_t length){
+	encrypt_reset(ctx);
+	encrypt_update(ctx, in, out, length);
+	
+	return encrypt_finish(ctx);
+}
+
+//Encrypt the next piece of a stream, continuing from the s value the previous piece left off at
+int encrypt_update(encrypt_context* ctx, const char* in, char* out, size_t length){
+	size_t done;
+	int n;
+	
+	if ( ctx->finished ) {
+		return ENCRYPT_FINISHED;
+	}
+	
+	for(done = 0; done < length; done += n ) {
+		n = (length - done < ENCRYPT_CHUNK) ? (int) (length - done) : ENCRYPT_CHUNK;
+		
+		if ( in != out ) {
+			memcpy(out + done, in + done, n);
+		}
+		
+		histogramCount(&ctx->inputCount, &ctx->inputPending, out + done, n);
+		if ( ctx->decrypt ) {
+			decryptBlock(out + done, n, &ctx->s);
+		} else {
+			encryptBlock(out + done, n, &ctx->s);
+		}
+		histogramCount(&ctx->outputCount, &ctx->outputPending, out + done, n);
+	}
+	
+	ctx->total += length;
+	
+	return ENCRYPT_OK;
+}
+
+//End the stream. Every character is written out by encrypt_update already, so this only folds the pending counts and
+//closes the context to further input.
+int encrypt_finish(encrypt_context* ctx){
+	ctx->finished = 1;
+	histogramFold(&ctx->inputCount, &ctx->inputPending);
+	histogramFold(&ctx->outputCount, &ctx->outputPending);
+	
+	return ENCRYPT_OK;
+}
+
+const unsigned long long* encrypt_input_counts(encrypt_context* ctx){
+	histogramFold(&ctx->inputCount, &ctx->inputPending);
+	return ctx->inputCount.counts;
+}
+
+const unsigned long long* encrypt_output_counts(encrypt_context* ctx){
+	histogramFold(&ctx->outputCount, &ctx->outputPending);
+	return ctx->outputCount.counts;
+}
+
+unsigned long long encrypt_total(const encrypt_context* ctx){
+	return ctx->total;
+}
+
+int encrypt_state(const encrypt_context* ctx){
+	return ctx->s;
+}
@@ -0,0 +1,49 @@
+/**
+	Embeddable, reentrant interface to the encryption engine.
+	
+	All state lives in an encrypt_context: the s value carried between calls and the input and output histograms. Separate
+	contexts share nothing, so any number of threads can each drive their own without locking. Nothing here touches files,
+	globals or the pipeline threads in main.c.
+	
+	One shot:
+		encrypt_buffer(ctx, in, out, length);
+	
+	Streaming (the result is the same however the input is split):
+		encrypt_reset(ctx);
+		while ( more input ) encrypt_update(ctx, in, out, length);
+		encrypt_finish(ctx);
+	
+	in and out may be the same buffer to encrypt in place. After encrypt_set_decrypt(ctx, 1) the same calls decrypt
+	instead. Build with 'make libencrypt.a' and link with -pthread.
+*/
+
+#ifndef ENCRYPTLIB_H
+#define ENCRYPTLIB_H
+
+#include <stddef.h>
+
+//Results of the calls below
+#define ENCRYPT_OK 0
+#define ENCRYPT_FINISHED -1 //encrypt_update after encrypt_finish, without a reset in between
+
+typedef struct encrypt_context encrypt_context;
+
+encrypt_context* encrypt_create(void);
+void encrypt_destroy(encrypt_context* ctx);
+void encrypt_reset(encrypt_context* ctx);
+void encrypt_set_decrypt(encrypt_context* ctx, int decrypt);
+
+int encrypt_buffer(encrypt_context* ctx, const char* in, char* out, size_t length);
+int encrypt_update(encrypt_context* ctx, const char* in, char* out, size_t length);
+int encrypt_finish(encrypt_context* ctx);
+
+//Occurences of each byte value (indexed by unsigned char) since the last reset, 256 entries each. Not const, as any
+//counts still pending in the context are folded in first; the pointer is valid until the next call on ctx.
+const unsigned long long* encrypt_input_counts(encrypt_context* ctx);
+const unsigned long long* encrypt_output_counts(encrypt_context* ctx);
+
+//Bytes processed since the last reset, and the s value the next character will be encrypted with
+unsigned long long encrypt_total(const encrypt_context* ctx);
+int encrypt_state(const encrypt_context* ctx);
+
+#endif
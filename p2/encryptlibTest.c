@@ -0,0 +1,111 @@
+/**
+	Checks the library interface against the original encrypt(): one shot and streamed in random pieces must give the
+	same output, s and histograms, and contexts driven alternately must not affect each other. Decrypting the result must
+	give back the input.
+*/
+
+//CLib imports
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "encryptlib.h"
+#include "cipher.h"
+
+#define MAX_LENGTH 40000
+
+int main(int argc, char** argv) {
+	static char input[MAX_LENGTH];
+	static char expected[MAX_LENGTH];
+	static char oneShot[MAX_LENGTH];
+	static char streamed[MAX_LENGTH];
+	unsigned long long inCounts[256], outCounts[256];
+	encrypt_context* single = encrypt_create();
+	encrypt_context* stream = encrypt_create();
+	int round, length, done, piece, s, i;
+	int failures = 0;
+	
+	srand(352);
+	
+	for(round = 0; round < 100; round++ ) {
+		length = rand() % MAX_LENGTH;
+		
+		for(i = 0; i < length; i++ ) {
+			input[i] = (rand() % 2) ? "AZazbyMm .\n"[rand() % 11] : (char) (rand() & 0xFF);
+		}
+		
+		//Oracle
+		memset(inCounts, 0, sizeof(inCounts));
+		memset(outCounts, 0, sizeof(outCounts));
+		s = 1;
+		for(i = 0; i < length; i++ ) {
+			expected[i] = encrypt(input[i], &s);
+			inCounts[(unsigned char) input[i]]++;
+			outCounts[(unsigned char) expected[i]]++;
+		}
+		
+		//Streamed in random pieces, alternating with one shot calls on the other context, in place every other round
+		encrypt_reset(stream);
+		memcpy(streamed, input, length);
+		for(done = 0; done < length; done += piece ) {
+			piece = rand() % 3000;
+			if ( piece > length - done ) {
+				piece = length - done;
+			}
+			
+			encrypt_update(stream, (round % 2) ? streamed + done : input + done, streamed + done, piece);
+			encrypt_buffer(single, input, oneShot, length);
+		}
+		encrypt_finish(stream);
+		encrypt_buffer(single, input, oneShot, length);
+		
+		if ( memcmp(expected, oneShot, length) != 0 || encrypt_state(single) != s ||
+			memcmp(inCounts, encrypt_input_counts(single), sizeof(inCounts)) != 0 ||
+			memcmp(outCounts, encrypt_output_counts(single), sizeof(outCounts)) != 0 ) {
+			printf("FAIL encrypt_buffer: length %d\n", length);
+			failures++;
+		}
+		
+		if ( memcmp(expected, streamed, length) != 0 || encrypt_state(stream) != s || encrypt_total(stream) != (unsigned long long) length ||
+			memcmp(inCounts, encrypt_input_counts(stream), sizeof(inCounts)) != 0 ||
+			memcmp(outCounts, encrypt_output_counts(stream), sizeof(outCounts)) != 0 ) {
+			printf("FAIL encrypt_update: length %d\n", length);
+			failures++;
+		}
+		
+		//Round trip, decrypting in place in pieces
+		encrypt_reset(stream);
+		encrypt_set_decrypt(stream, 1);
+		for(done = 0; done < length; done += piece ) {
+			piece = 1 + rand() % 5000;
+			if ( piece > length - done ) {
+				piece = length - done;
+			}
+			
+			encrypt_update(stream, streamed + done, streamed + done, piece);
+		}
+		encrypt_finish(stream);
+		encrypt_set_decrypt(stream, 0);
+		
+		if ( memcmp(input, streamed, length) != 0 || memcmp(outCounts, encrypt_input_counts(stream), sizeof(outCounts)) != 0 ) {
+			printf("FAIL decrypt round trip: length %d\n", length);
+			failures++;
+		}
+		
+		if ( encrypt_update(stream, input, streamed, 1) != ENCRYPT_FINISHED ) {
+			printf("FAIL encrypt_update accepted input after encrypt_finish\n");
+			failures++;
+		}
+	}
+	
+	encrypt_destroy(single);
+	encrypt_destroy(stream);
+	
+	if ( failures ) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	
+	printf("Library output and histograms match encrypt() and decrypt back\n");
+	return 0;
+}
@@ -0,0 +1,137 @@
+/**
+	Block counting engine for the character histograms.
+	
+	A single table of counters serializes on store-to-load forwarding whenever neighbouring bytes are equal (which is the
+	common case in text), so histogramCount spreads each 8 byte word over four interleaved sub-histograms, which are only
+	folded into the 64 bit counters by histogramFold (histogramAdd does both for a single block).
+*/
+
+//CLib imports
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "histogram.h"
+
+//Sub-histograms use 32 bit counters, so fold at least once per this many bytes
+#define MAX_FOLD_LENGTH (1 << 30)
+
+//Reset every counter
+void histogramClear(histogram* h){
+	memset(h->counts, 0, sizeof(h->counts));
+}
+
+//Count every byte of a block into h
+void histogramAdd(histogram* h, const char* data, int length){
+	histogramPending pending;
+	
+	histogramPendingClear(&pending);
+	histogramCount(h, &pending, data, length);
+	histogramFold(h, &pending);
+}
+
+void histogramPendingClear(histogramPending* pending){
+	memset(pending->sub, 0, sizeof(pending->sub));
+	pending->length = 0;
+}
+
+//Count every byte of a block into pending, folding into h only when the sub-histograms could otherwise overflow
+void histogramCount(histogram* h, histogramPending* pending, const char* data, int length){
+	const unsigned char* bytes = (const unsigned char*) data;
+	uint32_t (*sub)[256] = pending->sub;
+	uint64_t word;
+	int i = 0;
+	int end;
+	
+	while ( i < length ) {
+		if ( pending->length == MAX_FOLD_LENGTH ) {
+			histogramFold(h, pending);
+		}
+		
+		end = (length - i > MAX_FOLD_LENGTH - (int) pending->length) ? i + MAX_FOLD_LENGTH - (int) pending->length : length;
+		pending->length += end - i;
+		
+		for( ; i + 8 <= end; i += 8 ) {
+			memcpy(&word, bytes + i, sizeof(word));
+			
+			sub[0][word & 0xFF]++;
+			sub[1][(word >> 8) & 0xFF]++;
+			sub[2][(word >> 16) & 0xFF]++;
+			sub[3][(word >> 24) & 0xFF]++;
+			sub[0][(word >> 32) & 0xFF]++;
+			sub[1][(word >> 40) & 0xFF]++;
+			sub[2][(word >> 48) & 0xFF]++;
+			sub[3][word >> 56]++;
+		}
+		
+		for( ; i < end; i++ ) {
+			sub[0][bytes[i]]++;
+		}
+	}
+}
+
+//Add everything counted into pending to h and empty pending again
+void histogramFold(histogram* h, histogramPending* pending){
+	int j;
+	
+	if ( pending->length == 0 ) {
+		return;
+	}
+	
+	for(j = 0; j < 256; j++ ) {
+		h->counts[j] += (uint64_t) pending->sub[0][j] + pending->sub[1][j] + pending->sub[2][j] + pending->sub[3][j];
+	}
+	
+	histogramPendingClear(pending);
+}
+
+//Add the counters of from into into
+void histogramMerge(histogram* into, const histogram* from){
+	int i;
+	
+	for(i = 0; i < 256; i++ ) {
+		into->counts[i] += from->counts[i];
+	}
+}
+
+//Print the title line and then each character that occurs with its count (newlines are left out, as they would break the listing)
+void histogramPrint(FILE* out, const char* title, const histogram* h){
+	int i;
+	
+	fprintf(out, "%s \n", title);
+	
+	for(i = 0; i < 256; i++ ) {
+		if ( h->counts[i] > 0 && ((char) i) != '\n' ) {
+			fprintf(out, "%c %llu \n", (char) i, h->counts[i]);
+		}
+	}
+}
+
+//Write a histogram as one line: a label followed by all 256 counts
+void histogramSave(FILE* out, const char* label, const histogram* h){
+	int i;
+	
+	fprintf(out, "%s", label);
+	for(i = 0; i < 256; i++ ) {
+		fprintf(out, " %llu", h->counts[i]);
+	}
+	fprintf(out, "\n");
+}
+
+//Read a line written by histogramSave with the given label. Returns 0 if it isn't one.
+int histogramLoad(FILE* in, const char* label, histogram* h){
+	char found[16];
+	int i;
+	
+	if ( fscanf(in, "%15s", found) != 1 || strcmp(found, label) != 0 ) {
+		return 0;
+	}
+	
+	for(i = 0; i < 256; i++ ) {
+		if ( fscanf(in, "%llu", &h->counts[i]) != 1 ) {
+			return 0;
+		}
+	}
+	
+	return 1;
+}
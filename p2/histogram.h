@@ -0,0 +1,36 @@
+/**
+	Byte histograms for the input and output character counts.
+	
+	Counters are 64 bit and cover all 256 byte values. Partial histograms (one per thread) are merged with histogramMerge.
+	
+	Callers that count many small pieces keep a histogramPending next to the histogram and count with histogramCount, which
+	only folds the 32 bit sub-histograms into the 64 bit counters when they fill up; histogramFold brings the counters up to
+	date before they are read.
+*/
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+typedef struct {
+	unsigned long long counts[256]; //Occurences of each byte value
+} histogram;
+
+typedef struct {
+	uint32_t sub[4][256]; //Interleaved counts not yet in the 64 bit counters
+	uint32_t length; //Bytes counted into sub since the last fold
+} histogramPending;
+
+void histogramClear(histogram* h);
+void histogramAdd(histogram* h, const char* data, int length);
+void histogramPendingClear(histogramPending* pending);
+void histogramCount(histogram* h, histogramPending* pending, const char* data, int length);
+void histogramFold(histogram* h, histogramPending* pending);
+void histogramMerge(histogram* into, const histogram* from);
+void histogramPrint(FILE* out, const char* title, const histogram* h);
+void histogramSave(FILE* out, const char* label, const histogram* h);
+int histogramLoad(FILE* in, const char* label, histogram* h);
+
+#endif
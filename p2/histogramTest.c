@@ -0,0 +1,87 @@
+/**
+	Checks histogramAdd and histogramCount against a plain one byte at a time count, including bytes >= 0x80 and odd lengths
+	and offsets.
+*/
+
+//CLib imports
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "histogram.h"
+
+#define MAX_LENGTH 5000
+
+int main(int argc, char** argv) {
+	static char data[MAX_LENGTH];
+	histogram actual;
+	histogramPending pending;
+	unsigned long long expected[256];
+	int round, length, offset, i, piece;
+	int failures = 0;
+	
+	srand(352);
+	
+	for(round = 0; round < 500; round++ ) {
+		length = rand() % MAX_LENGTH;
+		offset = rand() % 8;
+		if ( offset + length > MAX_LENGTH ) {
+			length = MAX_LENGTH - offset;
+		}
+		
+		for(i = 0; i < MAX_LENGTH; i++ ) {
+			//Mostly runs of the same byte, the case interleaving is for
+			data[i] = (rand() % 4) ? data[i > 0 ? i - 1 : 0] : (char) (rand() & 0xFF);
+		}
+		
+		memset(expected, 0, sizeof(expected));
+		for(i = offset; i < offset + length; i++ ) {
+			expected[(unsigned char) data[i]]++;
+		}
+		
+		//Counting in two pieces must accumulate
+		histogramClear(&actual);
+		histogramAdd(&actual, data + offset, length / 2);
+		histogramAdd(&actual, data + offset + length / 2, length - length / 2);
+		
+		if ( memcmp(expected, actual.counts, sizeof(expected)) != 0 ) {
+			printf("FAIL histogramAdd: length %d, offset %d\n", length, offset);
+			failures++;
+		}
+		
+		//Small pieces counted into pending must only show up once folded
+		histogramClear(&actual);
+		histogramPendingClear(&pending);
+		for(i = 0; i < length; i += piece ) {
+			piece = 1 + rand() % 97;
+			if ( piece > length - i ) {
+				piece = length - i;
+			}
+			histogramCount(&actual, &pending, data + offset + i, piece);
+		}
+		histogramFold(&actual, &pending);
+		
+		if ( memcmp(expected, actual.counts, sizeof(expected)) != 0 ) {
+			printf("FAIL histogramCount: length %d, offset %d\n", length, offset);
+			failures++;
+		}
+		
+		//Merging two copies doubles every counter
+		histogramMerge(&actual, &actual);
+		for(i = 0; i < 256; i++ ) {
+			if ( actual.counts[i] != expected[i] * 2 ) {
+				printf("FAIL histogramMerge: byte %d\n", i);
+				failures++;
+				break;
+			}
+		}
+	}
+	
+	if ( failures ) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	
+	printf("Histograms match a byte at a time count\n");
+	return 0;
+}
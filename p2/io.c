@@ -0,0 +1,248 @@
+/**
+	File I/O backends for the encrypt pipeline.
+	
+	mapInput only succeeds for regular files, so callers fall back to buffered streams for pipes, terminals and anything
+	else that can't be mapped. Likewise uringInit fails on kernels (or sandboxes) without io_uring and callers fall back to
+	blocking I/O on their own thread.
+*/
+
+//CLib imports
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <string.h>
+#include <errno.h>
+
+#include "io.h"
+
+//Map a regular file read-only. Returns 0 (leaving nothing open) if the file can't be mapped.
+int mapInput(const char* path, mappedFile* m){
+	struct stat info;
+	
+	m->data = NULL;
+	m->fd = open(path, O_RDONLY);
+	if ( m->fd < 0 ) {
+		return 0;
+	}
+	
+	if ( fstat(m->fd, &info) < 0 || !S_ISREG(info.st_mode) ) {
+		close(m->fd);
+		return 0;
+	}
+	
+	m->length = (size_t) info.st_size;
+	
+	//Nothing to map for an empty file
+	if ( m->length == 0 ) {
+		return 1;
+	}
+	
+	m->data = (char*) mmap(NULL, m->length, PROT_READ, MAP_PRIVATE, m->fd, 0);
+	if ( m->data == MAP_FAILED ) {
+		m->data = NULL;
+		close(m->fd);
+		return 0;
+	}
+	
+	//We stream through it once
+	madvise(m->data, m->length, MADV_SEQUENTIAL);
+	
+	return 1;
+}
+
+//Create (or truncate) a file, size it to length and map it shared for writing. Returns 0 if it can't be mapped.
+int mapOutput(const char* path, size_t length, mappedFile* m){
+	struct stat info;
+	
+	m->data = NULL;
+	m->length = length;
+	m->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if ( m->fd < 0 ) {
+		return 0;
+	}
+	
+	if ( fstat(m->fd, &info) < 0 || !S_ISREG(info.st_mode) || ftruncate(m->fd, (off_t) length) < 0 ) {
+		close(m->fd);
+		return 0;
+	}
+	
+	if ( length == 0 ) {
+		return 1;
+	}
+	
+	m->data = (char*) mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, m->fd, 0);
+	if ( m->data == MAP_FAILED ) {
+		m->data = NULL;
+		close(m->fd);
+		return 0;
+	}
+	
+	madvise(m->data, length, MADV_SEQUENTIAL);
+	
+	return 1;
+}
+
+//Unmap and close. Dirty pages of a shared mapping are written back by the kernel.
+void unmapFile(mappedFile* m){
+	if ( m->data != NULL ) {
+		munmap(m->data, m->length);
+		m->data = NULL;
+	}
+	
+	close(m->fd);
+}
+
+//Set up a ring with room for entries submissions. Returns 0 if io_uring isn't available.
+int uringInit(uring* r, unsigned int entries){
+	struct io_uring_params params;
+	
+	memset(r, 0, sizeof(uring));
+	memset(&params, 0, sizeof(params));
+	
+#ifdef __NR_io_uring_setup
+	r->fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+#else
+	r->fd = -1;
+#endif
+	if ( r->fd < 0 ) {
+		return 0;
+	}
+	
+	r->sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	r->cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	r->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+	
+	//Newer kernels share one mapping for both rings
+	if ( params.features & IORING_FEAT_SINGLE_MMAP ) {
+		if ( r->cqMapSize > r->sqMapSize ) {
+			r->sqMapSize = r->cqMapSize;
+		}
+		r->cqMapSize = r->sqMapSize;
+	}
+	
+	r->sqMap = mmap(NULL, r->sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if ( r->sqMap == MAP_FAILED ) {
+		r->sqMap = NULL;
+		uringDestroy(r);
+		return 0;
+	}
+	
+	if ( params.features & IORING_FEAT_SINGLE_MMAP ) {
+		r->cqMap = r->sqMap;
+	} else {
+		r->cqMap = mmap(NULL, r->cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+		if ( r->cqMap == MAP_FAILED ) {
+			r->cqMap = NULL;
+			uringDestroy(r);
+			return 0;
+		}
+	}
+	
+	r->sqes = (struct io_uring_sqe*) mmap(NULL, r->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if ( r->sqes == MAP_FAILED ) {
+		r->sqes = NULL;
+		uringDestroy(r);
+		return 0;
+	}
+	
+	r->sqHead = (unsigned int*) ((char*) r->sqMap + params.sq_off.head);
+	r->sqTail = (unsigned int*) ((char*) r->sqMap + params.sq_off.tail);
+	r->sqMask = (unsigned int*) ((char*) r->sqMap + params.sq_off.ring_mask);
+	r->sqArray = (unsigned int*) ((char*) r->sqMap + params.sq_off.array);
+	r->cqHead = (unsigned int*) ((char*) r->cqMap + params.cq_off.head);
+	r->cqTail = (unsigned int*) ((char*) r->cqMap + params.cq_off.tail);
+	r->cqMask = (unsigned int*) ((char*) r->cqMap + params.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe*) ((char*) r->cqMap + params.cq_off.cqes);
+	
+	return 1;
+}
+
+//Release the ring
+void uringDestroy(uring* r){
+	if ( r->sqes != NULL ) {
+		munmap(r->sqes, r->sqesSize);
+	}
+	
+	if ( r->cqMap != NULL && r->cqMap != r->sqMap ) {
+		munmap(r->cqMap, r->cqMapSize);
+	}
+	
+	if ( r->sqMap != NULL ) {
+		munmap(r->sqMap, r->sqMapSize);
+	}
+	
+	if ( r->fd >= 0 ) {
+		close(r->fd);
+	}
+	
+	r->fd = -1;
+}
+
+//Queue one operation. The caller never has more in flight than the ring was created for.
+static void uringQueue(uring* r, int opcode, int fd, const char* data, int length, long long offset, unsigned long long userData){
+	unsigned int tail = *r->sqTail;
+	unsigned int index = tail & *r->sqMask;
+	struct io_uring_sqe* sqe = &r->sqes[index];
+	
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	sqe->opcode = (unsigned char) opcode;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long long) (size_t) data;
+	sqe->len = (unsigned int) length;
+	sqe->off = (unsigned long long) offset;
+	sqe->user_data = userData;
+	r->sqArray[index] = index;
+	
+	//Publish the entry to the kernel
+	__atomic_store_n(r->sqTail, tail + 1, __ATOMIC_RELEASE);
+	r->toSubmit++;
+}
+
+//Queue a read of length bytes at offset into data
+void uringRead(uring* r, int fd, char* data, int length, long long offset, unsigned long long userData){
+	uringQueue(r, IORING_OP_READ, fd, data, length, offset, userData);
+}
+
+//Queue a write of length bytes from data at offset
+void uringWrite(uring* r, int fd, const char* data, int length, long long offset, unsigned long long userData){
+	uringQueue(r, IORING_OP_WRITE, fd, data, length, offset, userData);
+}
+
+//Pass queued entries to the kernel and block until at least waitFor completions are available. Returns 0 on failure.
+int uringSubmit(uring* r, unsigned int waitFor){
+	int submitted;
+	
+	do {
+		submitted = (int) syscall(__NR_io_uring_enter, r->fd, r->toSubmit, waitFor, waitFor ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	} while ( submitted < 0 && errno == EINTR );
+	
+	if ( submitted < 0 ) {
+		return 0;
+	}
+	
+	r->toSubmit -= (unsigned int) submitted;
+	
+	return 1;
+}
+
+//Take one completion if there is one. result is the byte count or -errno.
+int uringReap(uring* r, unsigned long long* userData, int* result){
+	unsigned int head = *r->cqHead;
+	struct io_uring_cqe* cqe;
+	
+	if ( head == __atomic_load_n(r->cqTail, __ATOMIC_ACQUIRE) ) {
+		return 0;
+	}
+	
+	cqe = &r->cqes[head & *r->cqMask];
+	*userData = cqe->user_data;
+	*result = cqe->res;
+	
+	__atomic_store_n(r->cqHead, head + 1, __ATOMIC_RELEASE);
+	
+	return 1;
+}
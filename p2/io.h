@@ -0,0 +1,61 @@
+/**
+	File I/O backends for the encrypt pipeline.
+	
+	mapped files back the --mmap mode: the input is mapped read-only and the output is pre-sized to the input's length and
+	mapped shared, so the pipeline stages work directly on the mapped pages.
+	
+	uring is a minimal io_uring wrapper (raw syscalls, no liburing) backing the --async mode, where the reader and writer
+	keep several block reads/writes in flight at once.
+*/
+
+#ifndef IO_H
+#define IO_H
+
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+//A file mapped into memory
+typedef struct {
+	char* data; //Start of the mapping (NULL for an empty file)
+	size_t length; //Size of the file
+	int fd; //Descriptor backing the mapping
+} mappedFile;
+
+int mapInput(const char* path, mappedFile* m);
+int mapOutput(const char* path, size_t length, mappedFile* m);
+void unmapFile(mappedFile* m);
+
+//An io_uring instance, used from a single thread
+typedef struct {
+	int fd; //Ring descriptor
+	unsigned int toSubmit; //Queued entries not yet passed to the kernel
+	
+	//Submission ring
+	unsigned int* sqHead;
+	unsigned int* sqTail;
+	unsigned int* sqMask;
+	unsigned int* sqArray;
+	struct io_uring_sqe* sqes;
+	
+	//Completion ring
+	unsigned int* cqHead;
+	unsigned int* cqTail;
+	unsigned int* cqMask;
+	struct io_uring_cqe* cqes;
+	
+	//Mappings to release
+	void* sqMap;
+	size_t sqMapSize;
+	void* cqMap;
+	size_t cqMapSize;
+	size_t sqesSize;
+} uring;
+
+int uringInit(uring* r, unsigned int entries);
+void uringDestroy(uring* r);
+void uringRead(uring* r, int fd, char* data, int length, long long offset, unsigned long long userData);
+void uringWrite(uring* r, int fd, const char* data, int length, long long offset, unsigned long long userData);
+int uringSubmit(uring* r, unsigned int waitFor);
+int uringReap(uring* r, unsigned long long* userData, int* result);
+
+#endif
@@ -1,13 +1,41 @@
 /**
 	A rudimentary multi-threaded encryption program. I used a custom queue implementation to manage the buffer. This queue has node objects representing an object in the queue/buffer to be written or moved.
+	Each node is a fixed size block of bytes so every semaphore round trip between stages moves a whole block instead of a single character.
 	
 	Functions:
 	readInput: Continously read input from a file placing things in the input buffer
 	countInput: Continously count things in the input buffer
-	encryptInput: Continously encrypt items in the input buffer, remove them from the buffer, and push them in the output buffer
+	encryptInput: Continously encrypt items in the input buffer, remove them from the buffer, and push them in the output buffer (-t of these run at once)
+	handOff: Moves encrypted blocks from the input buffer to the output buffer in file order
 	countOutput: Continously count things in the output buffer
 	write: Continously write things to the output file from the output buffer
 	
+	With --mmap the input and output files are mapped instead: the reader copies each block straight from the input mapping
+	into the output mapping, the other stages work on it there and the writer has nothing left to do.
+	
+	With --async the reader and writer (readInputAsync/writeOutputAsync) keep several block reads and writes in flight through
+	io_uring, publishing and retiring blocks in file order, so disk latency overlaps with the other stages.
+	
+	With --fused there are no stage threads at all: runFused reads, counts, encrypts, counts and writes each block on the
+	main thread, a cache sized piece at a time, which beats the handoffs when the input is already in memory.
+	
+	With --checkpoint the reader lets the pipeline drain at regular offsets so the writer can sync the output and record the
+	offset, s and both counts in outputfile.checkpoint; --resume picks a killed run up from there.
+	
+	With --pin each pipeline thread is started on a CPU of its own (affinity.c): auto keeps adjacent stages on sibling cores
+	or a shared cache, or a CPU list can be given. Blocks are not placed on any node: handOff swaps them between the two
+	queues on every block, so each one passes through every stage in turn.
+	
+	With --decrypt every path runs the cycle backwards instead, turning encrypted output back into the original input.
+	
+	Either file can be given as - for stdin/stdout, so encrypt can sit in a shell pipeline. Memory stays bounded by the
+	buffers whatever the stream length, and when the data goes to stdout the counts go to stderr (or the --counts file).
+	
+	With --batch the two arguments are a manifest (or directory) of input files and an output directory, and runBatch
+	(batch.c) encrypts the files on a pool of -t workers.
+	
+	With --serve socket there are no file arguments: runDaemon (daemon.c) keeps -t warm workers listening on a Unix domain
+	socket and encryptClient sends them jobs, so each file skips the process and pipeline startup.
 
 */
 
@@ -15,9 +43,53 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <errno.h>
+#include <limits.h>
 #include <string.h>
 #include <pthread.h>
 #include <semaphore.h>
+#include <stdatomic.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "cipher.h"
+#include "histogram.h"
+#include "io.h"
+#include "stats.h"
+#include "batch.h"
+#include "encryptlib.h"
+#include "checkpoint.h"
+#include "daemon.h"
+#include "affinity.h"
+
+//Keeps the producer and consumer indices of a queue on separate lines
+#define CACHE_LINE_SIZE 64
+
+//Bytes per block moved between stages unless overridden with -b
+#define DEFAULT_BLOCK_SIZE 16384
+
+//Default block size when encrypting with several threads, so each handoff moves a sizeable block
+#define PARALLEL_BLOCK_SIZE (1 << 20)
+
+//Most block reads or writes kept in flight at once with --async
+#define ASYNC_DEPTH 8
+
+//Buffer size (in blocks) when none is configured and there is no answer on stdin
+#define DEFAULT_BUFFER_SIZE 8
+
+//Buffer sizes (in blocks) tried by --auto-tune, and how long each one is measured for
+#define AUTO_TUNE_MIN 1
+#define AUTO_TUNE_MAX 64
+#define AUTO_TUNE_SAMPLE_MS 50
+
+//Upper bound on the memory --auto-tune may commit to blocks (both buffers)
+#define AUTO_TUNE_MEMORY (256 << 20)
+
+//Bytes between checkpoints when --resume is given without --checkpoint
+#define DEFAULT_CHECKPOINT_INTERVAL (64 << 20)
 
 /*
  * Object declarations
@@ -27,42 +99,98 @@
  
 typedef struct node node;
  
-//Object representing a single characted item in a buffer/queue
+//Object representing a block of input characters in a buffer/queue
 struct node {
-	char c; //This character
+	char* data; //The characters in this block (buffer, or a view into the output mapping in --mmap mode)
+	char* buffer; //Storage owned by this slot (blockSize bytes allocated, none in --mmap mode)
+	int length; //Number of characters in use
+	int last; //If this is the final block of the input (may be empty)
 
 	int counted; //If it has been counted yet or not
-	int encrypted; //If it has been encrypted yet or not
-	
-	node* prev; //One directional LL as Queue
+	int encrypted; //If it has been encrypted yet or not (guarded by reorderLock)
+	int s; //s value at the first character, worked out by countInput from the letters before this block (after the last once encrypted)
+	int checkpoint; //If the pipeline drains after this block for a checkpoint
+	int pending; //If an asynchronous read/write of it is still in flight (--async)
+	long long offset; //File offset of that read/write
 };
 
-//buffer queue
+//buffer queue -- bounded single-producer/single-consumer ring of preallocated slots.
+//head and tail are free running counters (count = tail - head) and each sits on its own cache line
+//so the enqueueing and dequeueing threads never bounce the same line between cores.
 typedef struct {
-	node* head; //Front of q (for dequeueing)
-	node* tail; // Back of q (for enqueuing)
+	_Alignas(CACHE_LINE_SIZE) atomic_uint head; //Front of q (for dequeueing), only advanced by the consumer
+	_Alignas(CACHE_LINE_SIZE) atomic_uint tail; //Back of q (for enqueuing), only advanced by the producer
 
+	_Alignas(CACHE_LINE_SIZE) node* slots; //Ring storage, allocated once in queueInit
+	unsigned int mask; //Number of slots - 1 (slot count is a power of two)
 	int capacity; //Max size
-	int count; //current size
+	
+	queueStats* stats; //Occupancy histogram, recorded by the producer
 } queue;
 
+//Pipeline stages, for instrumentation
+enum {
+	STAGE_READ,
+	STAGE_COUNT_IN,
+	STAGE_ENCRYPT,
+	STAGE_COUNT_OUT,
+	STAGE_WRITE,
+	STAGE_TOTAL
+};
+
 /*
  * End object declarations
  */
 
 //Prototypes
+int queueInit(queue* q, int capacity, int blockSize);
+void queueDestroy(queue* q);
+node* queueTail(queue* q);
+int enqueue(queue* q);
+node* queueHead(queue* q);
+int dequeue(queue* q);
+node* queueAt(queue* q, unsigned int position);
+
 void* readInput(void* args);
+void* readInputAsync(void* args);
 void* countInput(void* args);
 void* encryptInput(void* args);
+void handOff();
+void transformBlock(node* block);
+long countedLetters(histogram* h, histogramPending* pending);
+void foldCounts();
 void* countOutput(void* args);
 void* writeOutput(void* args);
+void* writeOutputAsync(void* args);
+void finishTransfer(int write, int fd, char* data, int done, int length, long long offset);
+int readBlock(char* data);
+void writeBlock(const char* data, int length, int flush);
+void runPipeline();
+void runFused();
 void debug(char* msg);
+void resumeFromCheckpoint();
+void writeCheckpoint(long long offset, int s);
+
+void configure(int argc, char** argv);
+void usage();
+int parseSize(const char* text);
+long long parseBytes(const char* text);
+int setOption(int opt, const char* value);
+int promptBufferSize();
+void setBufferSize(int* current, int size);
+void tuneBufferSize();
+double elapsedMs(struct timespec* since);
+void* sampleStats(void* args);
 
 //Shared data
 //Count variables
-int inputCount[255];
-int outputCount[255];
+histogram inputCount;
+histogram outputCount;
+histogramPending inputPending; //Counted into by the counting stages, folded into inputCount by foldCounts
+histogramPending outputPending;
 int bufSize;
+int blockSize = 0;
+int threadCount = 1;
 
 //I/O buffers
 queue input_bufferq;
@@ -76,254 +204,911 @@ sem_t encrypt_out;
 sem_t count_out;
 sem_t write_out;
 
+//Encryption workers (-t). Each claims the oldest counted block that nobody has taken yet; reorderLock serializes
+//handing finished blocks on in file order.
+atomic_uint encryptClaim; //Input buffer position of the next block to claim
+atomic_uint encryptLast; //Position of the final block, once a worker has encrypted it
+pthread_mutex_t reorderLock = PTHREAD_MUTEX_INITIALIZER;
+histogram* workerInputCounts; //Per worker partial counts with several workers (merged into inputCount at the end)
+histogram* workerOutputCounts; //Per worker partial counts with several workers (merged into outputCount at the end)
+histogramPending* workerInputPending; //Not yet folded into workerInputCounts
+histogramPending* workerOutputPending;
+
 //I/O Files
 FILE * inFile;
 FILE * outFile;
 
+//Mapped I/O files (--mmap)
+int useMmap = 0;
+mappedFile inMap;
+mappedFile outMap;
+
+//Asynchronous reads and writes (--async)
+int useAsync = 0;
+
+//Buffer size tuning (--auto-tune)
+int autoTune = 0;
+atomic_int writingDone;
+
+//Single pass on the main thread (--fused)
+int fused = 0;
+
+//Many files on a worker pool (--batch)
+int batch = 0;
+
+//Undo the transform instead (--decrypt)
+int decrypting = 0;
+
+//Checkpoints (--checkpoint, --resume). The run restarts at resumeOffset with s = resumeS.
+long long checkpointInterval = 0;
+int resume = 0;
+char* checkpointPath = NULL;
+struct stat inputInfo;
+long long resumeOffset = 0;
+int resumeS = 1;
+sem_t checkpointDone;
+
+//Where the character counts are printed (--counts), stdout unless that carries the data
+char* countsPath = NULL;
+
+//Thread placement (--pin auto|off|cpulist), worked out in runPipeline once the thread count is known
+char* pinSpec = NULL;
+
+//Server mode: the socket to listen on (--serve)
+char* serveSocket = NULL;
+
+//Instrumentation. Always collected, reported with --stats json|csv and sampled every --stats-interval ms.
+stageStats stages[STAGE_TOTAL] = {{"read"}, {"count_in"}, {"encrypt"}, {"count_out"}, {"write"}};
+queueStats queueCounters[2] = {{"input"}, {"output"}};
+char* statsFormat = NULL;
+int statsInterval = 0;
+struct timespec startTime;
+
 //debugging for output
 int debugging = 0;
 
 int main(int argc, char** argv) {
-	pthread_t in, icount, en, ocount, out;
+	pthread_t sampler;
+	FILE* countsOut = stdout;
+	struct stat info;
+	
+	configure(argc, argv);
+	clock_gettime(CLOCK_MONOTONIC, &startTime);
 	
-	//Validate argument size
-	if ( argc != 3 ) {
-		printf("Incorrect format. Should be: ./encrypt inputfile outputfile \n");
-		exit(0);
+	//The server only comes back if it couldn't start
+	if ( serveSocket != NULL ) {
+		runDaemon(serveSocket, threadCount, blockSize);
+		return EXIT_FAILURE;
 	}
 	
-	//Try to open files
-	inFile = fopen(argv[1], "r");
-	outFile = fopen(argv[2], "w");
+	if ( batch ) {
+		return runBatch(argv[optind], argv[optind + 1], threadCount, blockSize, decrypting) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
 	
-	if ( inFile == NULL ) {
-		printf("Input file doesn't exist \n");
-		exit(0);
+	//Checkpoints live next to the output and only make sense for real files. They need the threaded pipeline.
+	if ( checkpointInterval > 0 || resume ) {
+		if ( strcmp(argv[optind], "-") == 0 || strcmp(argv[optind + 1], "-") == 0 ) {
+			printf("Checkpoints need an input and output file \n");
+			exit(EXIT_FAILURE);
+		}
+		
+		if ( stat(argv[optind], &inputInfo) < 0 ) {
+			printf("Input file doesn't exist \n");
+			exit(EXIT_FAILURE);
+		}
+		
+		checkpointPath = (char*) malloc(strlen(argv[optind + 1]) + 12);
+		sprintf(checkpointPath, "%s.checkpoint", argv[optind + 1]);
+		
+		if ( checkpointInterval == 0 ) {
+			checkpointInterval = DEFAULT_CHECKPOINT_INTERVAL;
+		}
+		
+		fused = 0;
+		
+		if ( resume ) {
+			resumeFromCheckpoint();
+		}
 	}
 	
-	//Read Input
-	printf("Enter Buffer Size:");
-	fflush(stdout);	
-
-	char bufSizeReader[256];
-	fgets(bufSizeReader, 256, stdin);
-	bufSizeReader[strlen(bufSizeReader) - 1] = '\0';
+	//Try to map the files, falling back to streams for pipes and anything else that can't be mapped
+	//(and when resuming, since mapping the output truncates it)
+	if ( strcmp(argv[optind], "-") == 0 || strcmp(argv[optind + 1], "-") == 0 || resumeOffset > 0 ) {
+		useMmap = 0;
+	}
+	
+	if ( useMmap ) {
+		if ( mapInput(argv[optind], &inMap) ) {
+			if ( !mapOutput(argv[optind + 1], inMap.length, &outMap) ) {
+				unmapFile(&inMap);
+				useMmap = 0;
+			}
+		} else {
+			useMmap = 0;
+		}
+	}
+	
+	//Try to open files. A resumed run keeps the output synced so far and carries on after it.
+	if ( resumeOffset > 0 ) {
+		inFile = fopen(argv[optind], "r");
+		outFile = fopen(argv[optind + 1], "r+");
+		
+		if ( inFile == NULL || outFile == NULL || fstat(fileno(outFile), &info) < 0 || info.st_size < resumeOffset ||
+			fseeko(inFile, resumeOffset, SEEK_SET) != 0 || ftruncate(fileno(outFile), resumeOffset) != 0 ||
+			fseeko(outFile, resumeOffset, SEEK_SET) != 0 ) {
+			printf("Could not resume from the checkpoint \n");
+			exit(EXIT_FAILURE);
+		}
+	} else if ( !useMmap ) {
+		inFile = (strcmp(argv[optind], "-") == 0) ? stdin : fopen(argv[optind], "r");
+		outFile = (strcmp(argv[optind + 1], "-") == 0) ? stdout : fopen(argv[optind + 1], "w");
+		
+		if ( inFile == NULL ) {
+			printf("Input file doesn't exist \n");
+			exit(EXIT_FAILURE);
+		}
+		
+		if ( outFile == NULL ) {
+			printf("Could not open output file \n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	
+	//Keep the counts out of a data stream on stdout
+	if ( countsPath != NULL ) {
+		countsOut = fopen(countsPath, "w");
+		
+		if ( countsOut == NULL ) {
+			printf("Could not open counts file \n");
+			exit(EXIT_FAILURE);
+		}
+	} else if ( outFile == stdout ) {
+		countsOut = stderr;
+	}
+	
+	if ( statsInterval > 0 ) {
+		pthread_create(&sampler, NULL, sampleStats, NULL);
+	}
+	
+	if ( fused ) {
+		runFused();
+	} else {
+		runPipeline();
+	}
+	
+	if ( statsInterval > 0 ) {
+		pthread_join(sampler, NULL);
+	}
+	
+	if ( statsFormat != NULL ) {
+		statsReport(stderr, statsFormat, elapsedMs(&startTime), stages, STAGE_TOTAL, queueCounters, 2);
+	}
+	
+	if ( useMmap ) {
+		unmapFile(&inMap);
+		unmapFile(&outMap);
+	}
+	
+	histogramPrint(countsOut, "Input Counts:", &inputCount);
+	histogramPrint(countsOut, "Output Counts:", &outputCount);
+	
+	if ( countsOut != stdout && countsOut != stderr ) {
+		fclose(countsOut);
+	}
+	
+	//Finished, nothing left to resume
+	if ( checkpointPath != NULL ) {
+		unlink(checkpointPath);
+	}
+	
+	return EXIT_SUCCESS;
+}
 
-	//Convert it to an int
-	bufSize = atoi(bufSizeReader);
+/**
+	Runs the five stage threaded pipeline over the open files and waits for it to finish.
+*/
+void runPipeline(){
+	pthread_t in, icount, ocount, out;
+	pthread_t* encrypters = (pthread_t*) malloc(sizeof(pthread_t) * threadCount);
+	placement stagePlacement;
+	int i;
+	
+	//Pipeline threads in order: reader, input counter, encrypters, output counter, writer
+	if ( !placementInit(&stagePlacement, pinSpec, threadCount + 4) ) {
+		exit(EXIT_FAILURE);
+	}
+	
+	//Read Input (buffer size is in blocks) when it wasn't configured. The auto tuner allocates for its largest candidate.
+	if ( autoTune ) {
+		bufSize = AUTO_TUNE_MAX;
+		while ( bufSize > AUTO_TUNE_MIN && (long long) bufSize * blockSize * 2 > AUTO_TUNE_MEMORY ) {
+			bufSize /= 2;
+		}
+	} else if ( bufSize == 0 ) {
+		//stdin may be the data and stdout may be the output, so only prompt when both are free
+		bufSize = (inFile == stdin || outFile == stdout) ? DEFAULT_BUFFER_SIZE : promptBufferSize();
+	}
 	
 	//Initialize shared variables
 	//Buffers
-	input_bufferq.capacity = bufSize;
-	input_bufferq.count = 0;
-	output_bufferq.capacity = bufSize;
-	output_bufferq.count = 0;
+	if ( !queueInit(&input_bufferq, bufSize, useMmap ? 0 : blockSize) || !queueInit(&output_bufferq, bufSize, useMmap ? 0 : blockSize) ) {
+		printf("Could not allocate buffers \n");
+		exit(EXIT_FAILURE);
+	}
+	input_bufferq.stats = &queueCounters[0];
+	output_bufferq.stats = &queueCounters[1];
 	
-	//Initialize semaphores
-	sem_init(&read_in, 0, 1);
+	//Initialize semaphores (read_in and encrypt_out track free slots, the rest track items ready for that stage)
+	//The auto tuner starts small and hands out more slots as it goes.
+	sem_init(&read_in, 0, autoTune ? AUTO_TUNE_MIN : bufSize);
 	sem_init(&count_in, 0, 0);
 	sem_init(&encrypt_in, 0, 0);
-	sem_init(&encrypt_out, 0, 1);
+	sem_init(&encrypt_out, 0, autoTune ? AUTO_TUNE_MIN : bufSize);
 	sem_init(&count_out, 0, 0);	
 	sem_init(&write_out, 0, 0);
+	sem_init(&checkpointDone, 0, 0);
 	
 	//Create threads
 	//readInput(NULL);
-	pthread_create(&in, NULL, readInput, NULL);
-	pthread_create(&icount, NULL, countInput, NULL);
-	pthread_create(&en, NULL, encryptInput, NULL);
-	pthread_create(&ocount, NULL, countOutput, NULL);
-	pthread_create(&out, NULL, writeOutput, NULL);
+	//Mapped files need no reads or writes, so --mmap wins over --async
+	startPinned(&in, placementCpu(&stagePlacement, 0), (useAsync && !useMmap) ? readInputAsync : readInput, NULL);
+	startPinned(&icount, placementCpu(&stagePlacement, 1), countInput, NULL);
+	
+	//Several workers count as well as encrypt, so the counting stages only work out each block's s
+	atomic_init(&encryptClaim, 0);
+	atomic_init(&encryptLast, ~0u);
+	if ( threadCount > 1 ) {
+		workerInputCounts = (histogram*) calloc(threadCount, sizeof(histogram));
+		workerOutputCounts = (histogram*) calloc(threadCount, sizeof(histogram));
+		workerInputPending = (histogramPending*) calloc(threadCount, sizeof(histogramPending));
+		workerOutputPending = (histogramPending*) calloc(threadCount, sizeof(histogramPending));
+	}
+	
+	for(i = 0; i < threadCount; i++ ) {
+		startPinned(&encrypters[i], placementCpu(&stagePlacement, i + 2), encryptInput, (void*) (long) i);
+	}
+	
+	startPinned(&ocount, placementCpu(&stagePlacement, threadCount + 2), countOutput, NULL);
+	startPinned(&out, placementCpu(&stagePlacement, threadCount + 3), (useAsync && !useMmap) ? writeOutputAsync : writeOutput, NULL);
+	
+	if ( autoTune ) {
+		tuneBufferSize();
+	}
 	
 	//Wait for completion
 	pthread_join(in, NULL);
 	pthread_join(icount, NULL);
-	pthread_join(en, NULL);
+	for(i = 0; i < threadCount; i++ ) {
+		pthread_join(encrypters[i], NULL);
+	}
 	pthread_join(ocount, NULL);
 	pthread_join(out, NULL);
 	
-	printf("Input Counts: \n");
+	foldCounts();
+	if ( threadCount > 1 ) {
+		for(i = 0; i < threadCount; i++ ) {
+			histogramMerge(&inputCount, &workerInputCounts[i]);
+			histogramMerge(&outputCount, &workerOutputCounts[i]);
+		}
+		
+		free(workerInputCounts);
+		free(workerOutputCounts);
+		free(workerInputPending);
+		free(workerOutputPending);
+	}
+	
+	free(encrypters);
+	placementDestroy(&stagePlacement);
+	queueDestroy(&input_bufferq);
+	queueDestroy(&output_bufferq);
+}
 
-	int i;
-	for(i = 0; i < 255; i++ ) {
-		if ( inputCount[i] > 0 && ((char) i) != '\n' ) {
-			printf("%c %d \n",(char) i, inputCount[i]);
+/**
+	Runs the whole pipeline on the calling thread (--fused). Each block is read, then given to encrypt_update, which takes
+	it through input counting, encryption and output counting a cache sized piece at a time so every piece is still in L1
+	for the later passes, and then written. There are no queues, semaphores or cross core handoffs; s and both histograms
+	carry over exactly as they do between the threaded stages, so the results are identical.
+*/
+void runFused(){
+	encrypt_context* ctx = encrypt_create();
+	char* buffer = NULL;
+	char* data;
+	size_t offset = 0; //Position in the input
+	int length, last;
+	
+	if ( !useMmap ) {
+		buffer = (char*) aligned_alloc(CACHE_LINE_SIZE, ((blockSize + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE) * CACHE_LINE_SIZE);
+	}
+	
+	if ( ctx == NULL || (!useMmap && buffer == NULL) ) {
+		printf("Could not allocate buffers \n");
+		exit(EXIT_FAILURE);
+	}
+	
+	encrypt_set_decrypt(ctx, decrypting);
+	
+	do {
+		if ( useMmap ) {
+			//Copied from the input mapping and worked on in place in the output mapping
+			length = (inMap.length - offset < (size_t) blockSize) ? (int) (inMap.length - offset) : blockSize;
+			data = outMap.data + offset;
+			last = offset + length == inMap.length;
+			stageDone(&stages[STAGE_READ], length);
+			
+			encrypt_update(ctx, inMap.data + offset, data, length);
+		} else {
+			data = buffer;
+			length = readBlock(data);
+			last = length < blockSize;
+			stageDone(&stages[STAGE_READ], length);
+			
+			encrypt_update(ctx, data, data, length);
 		}
+		stageDone(&stages[STAGE_COUNT_IN], length);
+		stageDone(&stages[STAGE_ENCRYPT], length);
+		stageDone(&stages[STAGE_COUNT_OUT], length);
+		
+		if ( !useMmap ) {
+			writeBlock(data, length, 0);
+		}
+		stageDone(&stages[STAGE_WRITE], length);
+		
+		offset += length;
+	} while ( !last );
+	
+	encrypt_finish(ctx);
+	memcpy(inputCount.counts, encrypt_input_counts(ctx), sizeof(inputCount.counts));
+	memcpy(outputCount.counts, encrypt_output_counts(ctx), sizeof(outputCount.counts));
+	
+	if ( !useMmap ) {
+		writeBlock(NULL, 0, 1);
 	}
+	
+	encrypt_destroy(ctx);
+	free(buffer);
+	atomic_store(&writingDone, 1);
+}
 
-	printf("Output Counts: \n");
+/*
+ * Configuration
+ */
+
+//Read settings from the environment, then let command line options override them
+void configure(int argc, char** argv){
+	int opt;
+	char* value;
+	
+	static struct option longOptions[] = {
+		{"buffer-size", required_argument, NULL, 's'},
+		{"block-size", required_argument, NULL, 'b'},
+		{"threads", required_argument, NULL, 't'},
+		{"io", required_argument, NULL, 'i'},
+		{"mmap", no_argument, NULL, 'm'},
+		{"async", no_argument, NULL, 'a'},
+		{"auto-tune", no_argument, NULL, 'A'},
+		{"stats", required_argument, NULL, 'S'},
+		{"stats-interval", required_argument, NULL, 'I'},
+		{"fused", no_argument, NULL, 'F'},
+		{"batch", no_argument, NULL, 'B'},
+		{"counts", required_argument, NULL, 'C'},
+		{"decrypt", no_argument, NULL, 'D'},
+		{"checkpoint", required_argument, NULL, 'K'},
+		{"resume", no_argument, NULL, 'R'},
+		{"serve", required_argument, NULL, 'L'},
+		{"pin", required_argument, NULL, 'P'},
+		{NULL, 0, NULL, 0}
+	};
+	
+	//Environment
+	if ( (value = getenv("ENCRYPT_BUFFER_SIZE")) != NULL && !setOption('s', value) ) {
+		usage();
+	}
+	
+	if ( (value = getenv("ENCRYPT_BLOCK_SIZE")) != NULL && !setOption('b', value) ) {
+		usage();
+	}
 	
-	for(i = 0; i < 255; i++ ) {
-		if ( outputCount[i] > 0  && ((char) i) != '\n' ) {
-			printf("%c %d \n",(char) i, outputCount[i]);
+	if ( (value = getenv("ENCRYPT_THREADS")) != NULL && !setOption('t', value) ) {
+		usage();
+	}
+	
+	if ( (value = getenv("ENCRYPT_IO")) != NULL && !setOption('i', value) ) {
+		usage();
+	}
+	
+	if ( (value = getenv("ENCRYPT_AUTO_TUNE")) != NULL && atoi(value) ) {
+		autoTune = 1;
+	}
+	
+	if ( (value = getenv("ENCRYPT_FUSED")) != NULL && atoi(value) ) {
+		fused = 1;
+	}
+	
+	if ( (value = getenv("ENCRYPT_DECRYPT")) != NULL && atoi(value) ) {
+		decrypting = 1;
+	}
+	
+	if ( (value = getenv("ENCRYPT_CHECKPOINT")) != NULL && !setOption('K', value) ) {
+		usage();
+	}
+	
+	if ( (value = getenv("ENCRYPT_PIN")) != NULL && !setOption('P', value) ) {
+		usage();
+	}
+	
+	if ( (value = getenv("ENCRYPT_COUNTS")) != NULL && !setOption('C', value) ) {
+		usage();
+	}
+	
+	if ( (value = getenv("ENCRYPT_STATS")) != NULL && !setOption('S', value) ) {
+		usage();
+	}
+	
+	if ( (value = getenv("ENCRYPT_STATS_INTERVAL")) != NULL && !setOption('I', value) ) {
+		usage();
+	}
+	
+	//Parse options
+	while ( (opt = getopt_long(argc, argv, "s:b:t:ma", longOptions, NULL)) != -1 ) {
+		if ( !setOption(opt, optarg) ) {
+			usage();
 		}
 	}
 	
-	return 1;
+	//Validate argument size (a server takes its files from the clients)
+	if ( argc - optind != (serveSocket != NULL ? 0 : 2) ) {
+		usage();
+	}
+	
+	if ( blockSize == 0 ) {
+		//Batch and server workers each take whole files, so they don't need the big parallel blocks
+		blockSize = (threadCount > 1 && !batch && serveSocket == NULL) ? PARALLEL_BLOCK_SIZE : DEFAULT_BLOCK_SIZE;
+	}
 }
 
-//Enqueueing objects into a buffer queue
-//TODO Never: Memory management doe
-int enqueue(queue* q, char c){
-	if ( q->count == q->capacity ) {
-		return 0;
-	} 
+//Print the expected format and quit
+void usage(){
+	printf("Incorrect format. Should be: ./encrypt [-s buffersize] [-b blocksize] [-t threads] [--io stream|mmap|async] [--auto-tune] [--fused] [--decrypt] [--checkpoint bytes] [--resume] [--pin auto|off|cpulist] [--counts file] [--stats json|csv] [--stats-interval ms] inputfile|- outputfile|- \n"
+		"   or: ./encrypt --batch [-t workers] [-b blocksize] [--decrypt] manifest|directory outputdirectory \n"
+		"   or: ./encrypt --serve socket [-t workers] [-b blocksize] \n");
+	exit(EXIT_FAILURE);
+}
+
+//Apply one setting (an option letter and its value). Returns 0 if the value is invalid.
+int setOption(int opt, const char* value){
+	switch ( opt ) {
+		case 's':
+			bufSize = atoi(value);
+			return bufSize > 0;
+			
+		case 'b':
+			blockSize = parseSize(value);
+			return blockSize > 0;
+			
+		case 't':
+			threadCount = atoi(value);
+			return threadCount > 0;
+			
+		case 'i':
+			useMmap = strcmp(value, "mmap") == 0;
+			useAsync = strcmp(value, "async") == 0;
+			return useMmap || useAsync || strcmp(value, "stream") == 0;
+			
+		case 'm':
+			useMmap = 1;
+			return 1;
+			
+		case 'a':
+			useAsync = 1;
+			return 1;
+			
+		case 'A':
+			autoTune = 1;
+			return 1;
+			
+		case 'S':
+			statsFormat = (char*) value;
+			return strcmp(value, "json") == 0 || strcmp(value, "csv") == 0;
+			
+		case 'I':
+			statsInterval = atoi(value);
+			return statsInterval > 0;
+			
+		case 'F':
+			fused = 1;
+			return 1;
+			
+		case 'B':
+			batch = 1;
+			return 1;
+			
+		case 'C':
+			countsPath = (char*) value;
+			return 1;
+			
+		case 'D':
+			decrypting = 1;
+			return 1;
+			
+		case 'K':
+			checkpointInterval = parseBytes(value);
+			return checkpointInterval > 0;
+			
+		case 'R':
+			resume = 1;
+			return 1;
+			
+		case 'L':
+			serveSocket = (char*) value;
+			return 1;
+			
+		case 'P':
+			pinSpec = (char*) value;
+			return placementValid(value);
+	}
 	
-	node* newChar = (node*) malloc(sizeof(node));
-	newChar->counted = 0;
-	newChar->encrypted = 0;
-	newChar->c = c;
+	return 0;
+}
+
+//Parse a buffer or block size (see parseBytes), at most 1G so it fits an int. Returns -1 if it isn't one.
+int parseSize(const char* text){
+	long long size = parseBytes(text);
 	
-	if ( q->count == 0) {
-		q->head = newChar;
-		q->tail = newChar;
-	} else {
-		q->tail->prev = newChar;
-		q->tail = newChar;
+	if ( size > (1LL << 30) ) {
+		return -1;
 	}
 	
-	q->count = q->count + 1;
+	return (int) size;
+}
+
+//Parse a positive byte count with an optional K, M or G suffix, 64 bit so offsets past 2G work. Returns -1 if it isn't one.
+long long parseBytes(const char* text){
+	char* end;
+	long long size, multiplier = 1;
 	
-	return 1;
+	errno = 0;
+	size = strtoll(text, &end, 10);
+	
+	if ( *end == 'k' || *end == 'K' ) {
+		multiplier = 1LL << 10;
+		end++;
+	} else if ( *end == 'm' || *end == 'M' ) {
+		multiplier = 1LL << 20;
+		end++;
+	} else if ( *end == 'g' || *end == 'G' ) {
+		multiplier = 1LL << 30;
+		end++;
+	}
+	
+	if ( end == text || *end != '\0' || errno == ERANGE || size <= 0 || size > LLONG_MAX / multiplier ) {
+		return -1;
+	}
+	
+	return size * multiplier;
 }
 
-//Dequeue an object from the buffer
-//TODO: Memory management
-node* dequeue(queue* q){
-	if ( q->count == 0 ) {
-		return (node*)NULL;
+//Ask for the buffer size on stdin. Only prompts on a terminal, and uses the default if nothing is given.
+int promptBufferSize(){
+	char bufSizeReader[256];
+	int size;
+	
+	if ( isatty(STDIN_FILENO) ) {
+		printf("Enter Buffer Size:");
+		fflush(stdout);	
 	}
+
+	if ( fgets(bufSizeReader, 256, stdin) == NULL || bufSizeReader[0] == '\n' ) {
+		return DEFAULT_BUFFER_SIZE;
+	}
+
+	//Convert it to an int
+	size = atoi(bufSizeReader);
 	
-	//Grab node, move head pointer (could end up being null)
-	node* curNode = (node*) malloc(sizeof(node));
-	curNode->c = q->head->c;
-	curNode->counted = q->head->counted;
-	curNode->encrypted = q->head->encrypted;
+	if ( size <= 0 ) {
+		printf("Buffer size must be a positive number \n");
+		exit(EXIT_FAILURE);
+	}
 	
-	q->head = q->head->prev;
+	return size;
+}
+
+//Change how many slots of each buffer the pipeline may use by handing out or taking back free slot permits.
+//Taking them back waits for slots to drain, which they always do (even once the run is over).
+void setBufferSize(int* current, int size){
+	for( ; *current < size; (*current)++ ) {
+		sem_post(&read_in);
+		sem_post(&encrypt_out);
+	}
 	
-	//Set tail to null if this was our only element
-	if ( q->count == 1 ) {
-		q->tail = NULL;
+	for( ; *current > size; (*current)-- ) {
+		sem_wait(&read_in);
+		sem_wait(&encrypt_out);
 	}
+}
+
+//Milliseconds since a point in time
+double elapsedMs(struct timespec* since){
+	struct timespec now;
 	
-	q->count--;
+	clock_gettime(CLOCK_MONOTONIC, &now);
 	
-	return curNode;
+	return (now.tv_sec - since->tv_sec) * 1000.0 + (now.tv_nsec - since->tv_nsec) / 1000000.0;
 }
 
 /**
-	Encrypts characters with this methodology:
+	Measures throughput of the running pipeline at each candidate buffer size (doubling from AUTO_TUNE_MIN up to the
+	allocated size), then settles on the fastest for the rest of the run. Stops early if the input runs out.
+*/
+void tuneBufferSize(){
+	struct timespec start;
+	long long startBytes;
+	double rate;
+	double bestRate = -1;
+	int best = AUTO_TUNE_MIN;
+	int current = AUTO_TUNE_MIN;
+	int size;
+	
+	for(size = AUTO_TUNE_MIN; size <= bufSize && !atomic_load(&writingDone); size *= 2 ) {
+		setBufferSize(&current, size);
 		
-	1) s = 1;
-	2) Get next character c.
-	3) if c is not a letter then goto (7).
-	4) if (s==1) then increase c with wraparound (e.g., 'A' becomes 'B', 'c' becomes 'd', 'Z' becomes 'A', 'z' becomes 'a'), set s=-1, and goto (7).
-	5) if (s==-1) then decrease c with wraparound (e.g., 'B' becomes 'A', 'd' becomes 'c', 'A' becomes 'Z', 'a' becomes 'z'), set s=0, and goto (7).
-	6) if (s==0), then do not change c, and set s=1.
-	7) Encrypted character is c.
+		//Let the pipeline settle at the new size, then measure
+		usleep(AUTO_TUNE_SAMPLE_MS * 200);
+		
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		startBytes = atomic_load(&stages[STAGE_WRITE].bytes);
+		usleep(AUTO_TUNE_SAMPLE_MS * 1000);
+		rate = (atomic_load(&stages[STAGE_WRITE].bytes) - startBytes) / elapsedMs(&start);
+		
+		if ( rate > bestRate ) {
+			bestRate = rate;
+			best = size;
+		}
+	}
+	
+	setBufferSize(&current, best);
+	
+	if ( bestRate > 0 ) {
+		fprintf(stderr, "Auto-tune: buffer size %d blocks (%.1f MB/s) \n", best, bestRate / 1000.0);
+	}
+}
 
+/**
+	Periodically prints a one line snapshot of the stage counters and queue occupancy to stderr until the output is written.
 */
-char encrypt(char c, int* s){
-	int cVal = (int) c;
-	
-	if ( (cVal >= 65 && cVal <= 90) || (cVal >= 97 && cVal <= 122) ) {
-		//C is a letter
-		switch (*s) {
-			
-			//Decrease w/ wraparound
-			case -1:
-				*s = 0;
-				if (cVal == 65 ) {
-					cVal = 90;
-				} else if (cVal == 97 ) {
-					cVal = 122;
-				} else {
-					cVal = cVal - 1;
-				}
-				return (char) cVal;
-			
-			//Leave
-			case 0:
-				*s = 1;
-				return c;
-				
-			//Increase w/ wraparound
-			case 1:
-				*s = -1;
-				if ( cVal == 90 ) {
-					cVal = 65;
-				} else if ( cVal == 122 ) {
-					cVal = 97;
-				} else {
-					cVal = cVal + 1;
-				}
-				return (char) cVal;
+void* sampleStats(void* args){
+	int occupancy[2];
+	
+	while ( !atomic_load(&writingDone) ) {
+		usleep(statsInterval * 1000);
+		
+		occupancy[0] = (int) (atomic_load(&input_bufferq.tail) - atomic_load(&input_bufferq.head));
+		occupancy[1] = (int) (atomic_load(&output_bufferq.tail) - atomic_load(&output_bufferq.head));
+		statsSample(stderr, elapsedMs(&startTime), stages, STAGE_TOTAL, occupancy, queueCounters, 2);
+	}
+	
+	return (void*) NULL;
+}
+
+/*
+ * End configuration
+ */
+
+//Allocate the ring for a buffer queue along with a data block for every slot (unless blockSize is 0). Slot count is rounded up to a power of two so
+//positions wrap with a mask, but the queue still never holds more than capacity items.
+int queueInit(queue* q, int capacity, int blockSize){
+	unsigned int slotCount = 1;
+	unsigned int i;
+	
+	while ( slotCount < (unsigned int) capacity ) {
+		slotCount <<= 1;
+	}
+	
+	q->slots = (node*) calloc(slotCount, sizeof(node));
+	if ( q->slots == NULL ) {
+		return 0;
+	}
+	
+	q->mask = slotCount - 1;
+	q->capacity = capacity;
+	atomic_init(&q->head, 0);
+	atomic_init(&q->tail, 0);
+	
+	for(i = 0; i < slotCount && blockSize > 0; i++ ) {
+		q->slots[i].buffer = (char*) aligned_alloc(CACHE_LINE_SIZE, ((blockSize + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE) * CACHE_LINE_SIZE);
+		q->slots[i].data = q->slots[i].buffer;
+		if ( q->slots[i].buffer == NULL ) {
+			queueDestroy(q);
+			return 0;
 		}
-	} else {
-		return c;
 	}
+	
+	return 1;
+}
+
+//Release the ring storage. Data blocks may have been swapped between queues, but every slot still owns exactly one.
+void queueDestroy(queue* q){
+	unsigned int i;
+	
+	if ( q->slots == NULL ) {
+		return;
+	}
+	
+	for(i = 0; i <= q->mask; i++ ) {
+		free(q->slots[i].buffer);
+	}
+	
+	free(q->slots);
+	q->slots = NULL;
+}
+
+//Slot at a free running queue position (head <= position < tail for queued items)
+node* queueAt(queue* q, unsigned int position){
+	return &q->slots[position & q->mask];
+}
+
+//Slot the producer fills next, or NULL if the queue is full. Only called from the producing thread.
+node* queueTail(queue* q){
+	unsigned int tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+	unsigned int head = atomic_load_explicit(&q->head, memory_order_acquire);
+	
+	if ( tail - head == (unsigned int) q->capacity ) {
+		return (node*) NULL;
+	}
+	
+	return queueAt(q, tail);
+}
+
+//Enqueueing the block filled in at queueTail into a buffer queue. Only called from the producing thread.
+int enqueue(queue* q){
+	node* newBlock = queueTail(q);
+	
+	if ( newBlock == NULL ) {
+		return 0;
+	} 
+	
+	newBlock->counted = 0;
+	newBlock->encrypted = 0;
+	
+	//Publish the slot to the consumer
+	unsigned int tail = atomic_load_explicit(&q->tail, memory_order_relaxed) + 1;
+	atomic_store_explicit(&q->tail, tail, memory_order_release);
+	
+	if ( q->stats != NULL ) {
+		queueOccupancy(q->stats, tail - atomic_load_explicit(&q->head, memory_order_relaxed));
+	}
+	
+	return 1;
+}
+
+//Front of the buffer, or NULL if it is empty. Only called from the consuming thread.
+node* queueHead(queue* q){
+	unsigned int head = atomic_load_explicit(&q->head, memory_order_relaxed);
+	unsigned int tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+	
+	if ( head == tail ) {
+		return (node*) NULL;
+	}
+	
+	return queueAt(q, head);
+}
+
+//Dequeue the front block, handing its slot back to the producer. Only called from the consuming thread.
+int dequeue(queue* q){
+	if ( queueHead(q) == NULL ) {
+		return 0;
+	}
+	
+	atomic_store_explicit(&q->head, atomic_load_explicit(&q->head, memory_order_relaxed) + 1, memory_order_release);
+	
+	return 1;
 }
 
 /** 
-	Encrypts input of the input buffer, passing them to the output buffer one at a time
+	Encryption worker. Claims counted blocks in order from the input buffer, encrypts each in place starting from the s
+	value countInput worked out for it, then hands whatever is ready on to the output buffer. Blocks finish out of order
+	when several workers run, so the encrypted blocks waiting at the front of the input buffer act as the reorder buffer.
+	Claiming is one atomic increment and every block is handed off exactly once, so the work per block is O(1).
 	
-	Waits on: Input & output buffers to be available to touch (signaled by count in or writer)
-	Signals: Read in and count out
+	Waits on: Input buffer to have a counted block (signaled by count in)
+	Signals: Other workers once the final block is done (so they exit), plus whatever handOff signals
 */
 void* encryptInput(void* args){
-	node* curIn;
-	node* temp;
-	int s = 1;
-	int wasProcessed = 1;
+	int thread = (int) (long) args;
+	node* cur;
+	unsigned int position;
+	int last;
+	int i;
 	
 	while ( 1 ) {
+		stageWait(&stages[STAGE_ENCRYPT], &encrypt_in);
+		
+		//Every successful wait is matched by a counted block, apart from the wakeups after the final one
+		position = atomic_fetch_add(&encryptClaim, 1);
+		if ( position > atomic_load(&encryptLast) ) {
+			break;
+		}
 		
-		//Wait on input buffer
-		sem_wait(&encrypt_in);
-
 		debug("in encryption\n");
 		
-		curIn = input_bufferq.head;
-	
-		//Encrypt as many as we want
-		while ( curIn != NULL ) {
-			//debug("encryption not null\n");
-			if ( curIn->counted && !curIn->encrypted) {
-				if ( curIn->c != EOF && curIn->c != '\n' ) {
-					curIn->c = encrypt(curIn->c, &s); //Encrypt char, adjust S value	
-				}
-				
-				curIn->encrypted = 1;
-				debug("encrypted something\n");
-				
-				break;
-			}
-			
-			curIn = curIn->prev;
+		cur = queueAt(&input_bufferq, position);
+		last = cur->last; //The slot can be reused once handed off
+		
+		if ( threadCount > 1 ) {
+			//Count while the block is in this core's cache
+			histogramCount(&workerInputCounts[thread], &workerInputPending[thread], cur->data, cur->length);
+			transformBlock(cur);
+			histogramCount(&workerOutputCounts[thread], &workerOutputPending[thread], cur->data, cur->length);
+		} else {
+			transformBlock(cur);
 		}
+		stageDone(&stages[STAGE_ENCRYPT], cur->length);
+		debug("encrypted something\n");
+		
+		pthread_mutex_lock(&reorderLock);
+		cur->encrypted = 1;
+		handOff();
+		pthread_mutex_unlock(&reorderLock);
 		
-		//Establish if the sequential next element is ready to process
-		if (input_bufferq.count > 0 && input_bufferq.head->encrypted){
-			temp = dequeue(&input_bufferq);
-			//debug("Ready to go to output\n");
-			//Signal input buffer
-			sem_post(&read_in);
+		if ( last ) {
+			debug("--------FINISHED ENCRYPTING\n");
+			
+			//Wake the other workers so they find nothing left to claim
+			atomic_store(&encryptLast, position);
+			for(i = 1; i < threadCount; i++ ) {
+				sem_post(&encrypt_in);
+			}
+			break;
 		}
+	}
+	
+	return (void*) NULL;
+}
 
-		//Wait on output buffer
-		sem_wait(&encrypt_out);
+//Encrypt (or with --decrypt, decrypt) a block in place from its starting s
+void transformBlock(node* block){
+	if ( decrypting ) {
+		decryptBlock(block->data, block->length, &block->s);
+	} else {
+		encryptBlock(block->data, block->length, &block->s);
+	}
+}
+
+/**
+	Moves every encrypted block at the front of the input buffer to the output buffer, stopping at the first block still
+	being encrypted. Hands the block over by swapping data pointers with the free output slot (no copy). Only called with
+	reorderLock held, which makes the holder the input buffer's sole consumer and the output buffer's sole producer.
+	
+	Waits on: Output buffer to have a free slot (signaled by writer)
+	Signals: Read in and count out
+*/
+void handOff(){
+	node* curIn;
+	node* curOut;
+	char* temp;
+	
+	while ( (curIn = queueHead(&input_bufferq)) != NULL && curIn->encrypted ) {
+		stageWait(&stages[STAGE_ENCRYPT], &encrypt_out);
+		
+		curOut = queueTail(&output_bufferq);
+		temp = curOut->buffer;
+		curOut->buffer = curIn->buffer;
+		curIn->buffer = temp;
+		temp = curOut->data;
+		curOut->data = curIn->data;
+		curIn->data = temp;
+		curOut->length = curIn->length;
+		curOut->last = curIn->last;
+		curOut->s = curIn->s;
+		curOut->checkpoint = curIn->checkpoint;
 		
-		//If we can process this element
-		enqueue(&output_bufferq, temp->c);
+		//Move it out of the input buffer and signal the reader that a slot is free
+		dequeue(&input_bufferq);
+		sem_post(&read_in);
+		
+		enqueue(&output_bufferq);
 		debug("Pushed to output\n");
 		
 		sem_post(&count_out);
-
-		if ( temp->c == EOF ) {
-			debug("--------FINISHED ENCRYPTING\n");
-			break;
-		}
 	}
 }
 
@@ -334,110 +1119,193 @@ void* encryptInput(void* args){
 	Signals: Writer (to file)
 */
 void* countOutput(void* args){
-	int i;
 	node* cur;
+	unsigned int next = 0; //Queue position of the next uncounted block
+	int last;
 	
 	while ( 1 ) {
 		//Wait on output
-		sem_wait(&count_out);
+		stageWait(&stages[STAGE_COUNT_OUT], &count_out);
 		
-		cur = output_bufferq.head;
+		cur = queueAt(&output_bufferq, next++);
 		
 		debug("in output\n");
-		while ( cur != NULL ) {
-			//debug("In output not null\n");
-			if ( !cur->counted ) {
-				outputCount[cur->c] = outputCount[cur->c] + 1; //Increment this character count
-				cur->counted = 1;
-				
-				sem_post(&write_out);
-				
-				debug("Counted some output \n");
-				
-				if ( cur->c == EOF ) {
-					debug("--------FINISHED COUNTING OUT\n");
-					return (void*) NULL;
-				} else {
-					break;
-				}
-			} else {
-				cur = cur->prev;
-			}
+		//With several encryption workers they count each block instead
+		if ( threadCount == 1 ) {
+			histogramCount(&outputCount, &outputPending, cur->data, cur->length); //Count every character in the block
+		}
+		cur->counted = 1;
+		last = cur->last; //The slot can be reused as soon as we signal
+		stageDone(&stages[STAGE_COUNT_OUT], cur->length);
+		
+		sem_post(&write_out);
+		
+		debug("Counted some output \n");
+		
+		if ( last ) {
+			debug("--------FINISHED COUNTING OUT\n");
+			return (void*) NULL;
 		}
 	}
 }
 
 /**
-	Continously counts the character occurences in the input buffer
+	Continously counts the character occurences in the input buffer, and works out the s value each block starts with
 	
 	Waits on: Input Buffer to be available to touch (signaled by readinput)
 	Signals: Encryption
 */
 void* countInput(void* args){
-	int i;
 	node* cur;
+	unsigned int next = 0; //Queue position of the next uncounted block
+	int last;
+	int s = resumeS;
+	long letters;
 
 	while ( 1 ) {
 		//Wait on input
-		sem_wait(&count_in);
+		stageWait(&stages[STAGE_COUNT_IN], &count_in);
 		
-		cur = input_bufferq.head;
+		cur = queueAt(&input_bufferq, next++);
 		
 		debug("In counting\n");
-		while ( cur != NULL ) {
-			//debug("in count not null\n");
-			if ( cur->counted == 0 ) {
-				inputCount[cur->c] = inputCount[cur->c] + 1; //Increment this character count
-				cur->counted = 1;
-				
-				sem_post(&encrypt_in);
-				
-				debug("Counted some input \n");
-				
-				if ( cur->c == EOF ) {
-					debug("--------FINISHED COUNTING IN\n");
-					return (void*) NULL;
-				} else {
-					break;					
-				}
-			} else {
-				cur = cur->prev;
-			}	
+		//With several encryption workers they count each block instead, leaving just the letters to count here
+		if ( threadCount == 1 ) {
+			letters = countedLetters(&inputCount, &inputPending);
+			histogramCount(&inputCount, &inputPending, cur->data, cur->length); //Count every character in the block
+			letters = countedLetters(&inputCount, &inputPending) - letters;
+		} else {
+			letters = countLetters(cur->data, cur->length);
+		}
+		
+		//s only advances on letters, so this block starts where the letters before it left off
+		cur->s = s;
+		s = advanceState(s, letters);
+		cur->counted = 1;
+		last = cur->last; //The slot can be reused as soon as we signal
+		stageDone(&stages[STAGE_COUNT_IN], cur->length);
+		
+		sem_post(&encrypt_in);
+		
+		debug("Counted some input \n");
+		
+		if ( last ) {
+			debug("--------FINISHED COUNTING IN\n");
+			return (void*) NULL;
+		}
+	}
+	
+}
+
+//Total count of letters in a histogram and what is still pending for it (the sum doesn't change when pending is folded)
+long countedLetters(histogram* h, histogramPending* pending){
+	long letters = 0;
+	int c, i;
+	
+	for(c = 'A'; c <= 'Z'; c++ ) {
+		letters += h->counts[c] + h->counts[c + ('a' - 'A')];
+		for(i = 0; i < 4; i++ ) {
+			letters += pending->sub[i][c] + pending->sub[i][c + ('a' - 'A')];
 		}
+	}
+	
+	return letters;
+}
 
+//Bring every histogram up to date with its pending counts. Only called while no block is being counted: after the
+//threads are joined, or at a checkpoint, where the reader holds back the blocks after it.
+void foldCounts(){
+	int i;
+	
+	histogramFold(&inputCount, &inputPending);
+	histogramFold(&outputCount, &outputPending);
+	
+	for(i = 0; i < threadCount && threadCount > 1; i++ ) {
+		histogramFold(&workerInputCounts[i], &workerInputPending[i]);
+		histogramFold(&workerOutputCounts[i], &workerOutputPending[i]);
+	}
+}
+
+//Read up to blockSize bytes of the input stream. A short count is the end of the file, a read error ends the program.
+int readBlock(char* data){
+	int length = (int) fread(data, 1, blockSize, inFile);
+	
+	if ( length < blockSize && ferror(inFile) ) {
+		fprintf(stderr, "Error reading input file \n");
+		exit(EXIT_FAILURE);
 	}
 	
+	return length;
+}
+
+//Write a block to the output stream (and flush it if asked). A failed or short write ends the program.
+void writeBlock(const char* data, int length, int flush){
+	if ( (length > 0 && fwrite(data, 1, length, outFile) != (size_t) length) || (flush && fflush(outFile) != 0) ) {
+		fprintf(stderr, "Error writing output file \n");
+		exit(EXIT_FAILURE);
+	}
 }
 
 /**
-	Continously read input from a file byte-by-byte, writing to a buffer.
+	Continously read input from a file a block at a time, writing to a buffer.
 	
-	Waits on: Input Buffer to be available to touch (signaled by encryption)
+	Waits on: Input Buffer to have a free slot (signaled by encryption)
 	Signals: Counting thread
 */
 void* readInput(void* args){
-	char cur;
-	
-	cur = fgetc(inFile);
+	node* cur;
+	int last, checkpoint;
+	size_t offset = 0; //Position in the input mapping
+	long long position = resumeOffset; //Position in the input
+	long long nextCheckpoint = resumeOffset + checkpointInterval;
 	
 	while ( 1 ) {
 		//WAIT on input
-		sem_wait(&read_in);
+		stageWait(&stages[STAGE_READ], &read_in);
 		
-		if ( enqueue(&input_bufferq, cur) ) {
-			debug("Placed char in buffer (in)\n");
-			
-			sem_post(&count_in);
-			
-			if ( cur == EOF) {
-				debug("--------FINISHED READING\n");
-				break;
-			} else {
-				cur = fgetc(inFile);
+		cur = queueTail(&input_bufferq);
+		
+		if ( useMmap ) {
+			//Copy straight into the output mapping, the block is worked on in place from here on
+			cur->length = (inMap.length - offset < (size_t) blockSize) ? (int) (inMap.length - offset) : blockSize;
+			cur->data = outMap.data + offset;
+			if ( cur->length > 0 ) {
+				memcpy(cur->data, inMap.data + offset, cur->length);
 			}
+			offset += cur->length;
+			cur->last = offset == inMap.length;
+		} else {
+			//A short read only happens at the end of the file
+			cur->data = cur->buffer;
+			cur->length = readBlock(cur->data);
+			cur->last = cur->length < blockSize;
+		}
+		position += cur->length;
+		cur->checkpoint = checkpointInterval > 0 && !cur->last && position >= nextCheckpoint;
+		if ( cur->checkpoint ) {
+			nextCheckpoint = position + checkpointInterval;
+		}
+		last = cur->last;
+		checkpoint = cur->checkpoint;
+		stageDone(&stages[STAGE_READ], cur->length);
+		
+		enqueue(&input_bufferq);
+		debug("Placed block in buffer (in)\n");
+		
+		sem_post(&count_in);
+		
+		if ( last ) {
+			debug("--------FINISHED READING\n");
+			break;
 		}
 		
+		//Nothing more goes in until the writer has recorded the checkpoint, so the counts stop at its offset
+		if ( checkpoint ) {
+			sem_wait(&checkpointDone);
+		}
 	}
+	
+	return (void*) NULL;
 }
 
 /**
@@ -448,31 +1316,320 @@ void* readInput(void* args){
 */
 void* writeOutput(void* args){
 	node* cur;
+	int last;
+	long long written = resumeOffset; //Output offset after the head block
 	
 	while ( 1 ) {
 		//WAIT on output
-		sem_wait(&write_out);
+		stageWait(&stages[STAGE_WRITE], &write_out);
+		
+		//The head is always counted by now since the output counter signals in order
+		cur = queueHead(&output_bufferq);
+		
+		//Mapped output is already in place
+		if ( !useMmap ) {
+			writeBlock(cur->data, cur->length, 1);
+		}
+		stageDone(&stages[STAGE_WRITE], cur->length);
+		last = cur->last;
+		written += cur->length;
 		
-		cur = output_bufferq.head;
+		if ( cur->checkpoint ) {
+			writeCheckpoint(written, cur->s);
+		}
+		
+		dequeue(&output_bufferq);
+		sem_post(&encrypt_out);
+		
+		if ( last ) {
+			break;
+		}
+	}
+	
+	debug("-----------Finishing writing output\n");
+	atomic_store(&writingDone, 1);
+	
+	return (void*) NULL;
+}
 
-		//Iterate over each node, but break as soon as we find one that isn't counted to maintain order
-		if ( cur->counted ) {
-			dequeue(&output_bufferq);
+/**
+	Continously read input from a file with several block reads in flight, writing to a buffer in file order.
+	Falls back to readInput for stdin or anything but a regular file, or when io_uring isn't available.
+	
+	Waits on: Input Buffer to have free slots (signaled by encryption)
+	Signals: Counting thread
+*/
+void* readInputAsync(void* args){
+	uring ring;
+	struct stat info;
+	node* cur;
+	int fd = fileno(inFile);
+	int depth = bufSize < ASYNC_DEPTH ? bufSize : ASYNC_DEPTH;
+	unsigned int tail = atomic_load(&input_bufferq.tail); //Queue position of the oldest read in flight
+	int inflight = 0;
+	int allSubmitted = 0;
+	int finished = 0;
+	int checkpoint;
+	long long size;
+	long long offset = resumeOffset; //File offset of the next read
+	long long nextCheckpoint = resumeOffset + checkpointInterval;
+	unsigned long long position;
+	int result;
+	
+	//stdin may not start at offset 0 even when it is a regular file
+	if ( inFile == stdin || fstat(fd, &info) < 0 || !S_ISREG(info.st_mode) || !uringInit(&ring, depth) ) {
+		//Blocking reads on this thread, the buffer queue still lets them overlap with the other stages
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+		return readInput(args);
+	}
+	
+	size = (long long) info.st_size;
+	
+	while ( !finished ) {
+		//Claim free slots and start reading into them (block only if nothing is in flight)
+		while ( inflight < depth && !allSubmitted ) {
+			if ( inflight == 0 ) {
+				stageWait(&stages[STAGE_READ], &read_in);
+			} else if ( sem_trywait(&read_in) != 0 ) {
+				break;
+			}
+			
+			cur = queueAt(&input_bufferq, tail + inflight);
+			cur->data = cur->buffer;
+			cur->length = (size - offset < blockSize) ? (int) (size - offset) : blockSize;
+			cur->last = offset + cur->length == size;
+			cur->pending = cur->length > 0;
+			cur->offset = offset;
+			cur->checkpoint = checkpointInterval > 0 && !cur->last && offset + cur->length >= nextCheckpoint;
+			if ( cur->checkpoint ) {
+				nextCheckpoint = offset + cur->length + checkpointInterval;
+			}
+			
+			if ( cur->pending ) {
+				uringRead(&ring, fd, cur->data, cur->length, offset, tail + inflight);
+			}
+			
+			offset += cur->length;
+			allSubmitted = cur->last;
+			inflight++;
+		}
+		
+		//Wait only when the oldest read is still outstanding
+		if ( !uringSubmit(&ring, queueAt(&input_bufferq, tail)->pending ? 1 : 0) ) {
+			printf("Error reading input file \n");
+			exit(EXIT_FAILURE);
+		}
+		
+		while ( uringReap(&ring, &position, &result) ) {
+			cur = queueAt(&input_bufferq, (unsigned int) position);
+			
+			if ( result != cur->length ) {
+				finishTransfer(0, fd, cur->data, result < 0 ? 0 : result, cur->length, cur->offset);
+			}
+			
+			cur->pending = 0;
+		}
+		
+		//Publish completed reads in file order
+		while ( inflight > 0 && !queueAt(&input_bufferq, tail)->pending ) {
+			finished = queueAt(&input_bufferq, tail)->last;
+			checkpoint = queueAt(&input_bufferq, tail)->checkpoint;
+			stageDone(&stages[STAGE_READ], queueAt(&input_bufferq, tail)->length);
 			
-			if ( cur->c == EOF ) {
+			enqueue(&input_bufferq);
+			debug("Placed block in buffer (in)\n");
+			
+			sem_post(&count_in);
+			
+			tail++;
+			inflight--;
+			
+			//Reads already in flight carry on, but nothing more is published until the checkpoint is recorded
+			if ( checkpoint ) {
+				sem_wait(&checkpointDone);
+			}
+		}
+	}
+	
+	debug("--------FINISHED READING\n");
+	uringDestroy(&ring);
+	
+	return (void*) NULL;
+}
+
+/**
+	Write to the output file with several block writes in flight, releasing slots in file order.
+	Falls back to writeOutput for stdout or anything but a regular file, or when io_uring isn't available.
+	
+	Waits on: Output Buffer to be available to touch (signaled by output counter)
+	Signals: Encryption
+*/
+void* writeOutputAsync(void* args){
+	uring ring;
+	struct stat info;
+	node* cur;
+	int fd = fileno(outFile);
+	int depth = bufSize < ASYNC_DEPTH ? bufSize : ASYNC_DEPTH;
+	unsigned int head = atomic_load(&output_bufferq.head); //Queue position of the oldest write in flight
+	int inflight = 0;
+	int lastSubmitted = 0;
+	int finished = 0;
+	long long offset = resumeOffset; //File offset of the next write
+	unsigned long long position;
+	int result;
+	
+	if ( outFile == stdout || fstat(fd, &info) < 0 || !S_ISREG(info.st_mode) || !uringInit(&ring, depth) ) {
+		return writeOutput(args);
+	}
+	
+	while ( !finished ) {
+		//Start writing counted blocks (block only if nothing is in flight)
+		while ( inflight < depth && !lastSubmitted ) {
+			if ( inflight == 0 ) {
+				stageWait(&stages[STAGE_WRITE], &write_out);
+			} else if ( sem_trywait(&write_out) != 0 ) {
 				break;
 			}
 			
-			fputc(cur->c, outFile);
-			fflush(outFile);
+			cur = queueAt(&output_bufferq, head + inflight);
+			cur->pending = cur->length > 0;
+			cur->offset = offset;
+			
+			if ( cur->pending ) {
+				uringWrite(&ring, fd, cur->data, cur->length, offset, head + inflight);
+			}
 			
-			cur = cur->prev;
-		} 
+			offset += cur->length;
+			lastSubmitted = cur->last;
+			inflight++;
+		}
 		
-		sem_post(&encrypt_out);
+		//Wait only when the oldest write is still outstanding
+		if ( !uringSubmit(&ring, queueAt(&output_bufferq, head)->pending ? 1 : 0) ) {
+			printf("Error writing output file \n");
+			exit(EXIT_FAILURE);
+		}
+		
+		while ( uringReap(&ring, &position, &result) ) {
+			cur = queueAt(&output_bufferq, (unsigned int) position);
+			
+			if ( result != cur->length ) {
+				finishTransfer(1, fd, cur->data, result < 0 ? 0 : result, cur->length, cur->offset);
+			}
+			
+			cur->pending = 0;
+		}
+		
+		//Hand completed slots back in order
+		while ( inflight > 0 && !queueAt(&output_bufferq, head)->pending ) {
+			cur = queueAt(&output_bufferq, head);
+			finished = cur->last;
+			stageDone(&stages[STAGE_WRITE], cur->length);
+			
+			//Every write up to and including this block has completed
+			if ( cur->checkpoint ) {
+				writeCheckpoint(cur->offset + cur->length, cur->s);
+			}
+			
+			dequeue(&output_bufferq);
+			sem_post(&encrypt_out);
+			
+			head++;
+			inflight--;
+		}
 	}
 	
 	debug("-----------Finishing writing output\n");
+	atomic_store(&writingDone, 1);
+	uringDestroy(&ring);
+	
+	return (void*) NULL;
+}
+
+/**
+	Completes a short or failed asynchronous read/write of a block with blocking pread/pwrite calls, starting after the
+	bytes already transferred. Gives up on errors or if the input shrank underneath us.
+*/
+void finishTransfer(int write, int fd, char* data, int done, int length, long long offset){
+	ssize_t result;
+	
+	while ( done < length ) {
+		if ( write ) {
+			result = pwrite(fd, data + done, length - done, offset + done);
+		} else {
+			result = pread(fd, data + done, length - done, offset + done);
+		}
+		
+		if ( result <= 0 ) {
+			printf(write ? "Error writing output file \n" : "Error reading input file \n");
+			exit(EXIT_FAILURE);
+		}
+		
+		done += (int) result;
+	}
+}
+
+/**
+	Sets up a --resume run from the checkpoint next to the output, if there is one that matches this input and direction.
+	Otherwise the run starts from the beginning (and checkpoints as it goes).
+*/
+void resumeFromCheckpoint(){
+	checkpoint saved;
+	
+	if ( !loadCheckpoint(checkpointPath, &saved) ) {
+		return;
+	}
+	
+	if ( saved.inputSize != (long long) inputInfo.st_size || saved.inputMtime != (long long) inputInfo.st_mtime ||
+		saved.decrypt != decrypting || saved.offset > saved.inputSize ) {
+		fprintf(stderr, "Checkpoint doesn't match the input, starting over \n");
+		return;
+	}
+	
+	resumeOffset = saved.offset;
+	resumeS = saved.s;
+	inputCount = saved.inputCount;
+	outputCount = saved.outputCount;
+}
+
+/**
+	Records a checkpoint at an output offset once the pipeline has drained up to it (the reader is waiting on
+	checkpointDone, so every count so far covers exactly the bytes before offset). The output is synced first, so the
+	checkpoint never claims more than is on disk.
+	
+	Signals: Reader (checkpointDone)
+*/
+void writeCheckpoint(long long offset, int s){
+	checkpoint c;
+	int i, synced;
+	
+	if ( useMmap ) {
+		synced = msync(outMap.data, offset, MS_SYNC) == 0;
+	} else {
+		synced = fdatasync(fileno(outFile)) == 0;
+	}
+	
+	c.offset = offset;
+	c.s = s;
+	c.decrypt = decrypting;
+	c.inputSize = (long long) inputInfo.st_size;
+	c.inputMtime = (long long) inputInfo.st_mtime;
+	
+	foldCounts();
+	c.inputCount = inputCount;
+	c.outputCount = outputCount;
+	
+	//Several workers keep their counts separately until the end
+	for(i = 0; i < threadCount && threadCount > 1; i++ ) {
+		histogramMerge(&c.inputCount, &workerInputCounts[i]);
+		histogramMerge(&c.outputCount, &workerOutputCounts[i]);
+	}
+	
+	if ( !synced || !saveCheckpoint(checkpointPath, &c) ) {
+		fprintf(stderr, "Could not write checkpoint at offset %lld \n", offset);
+	}
+	
+	sem_post(&checkpointDone);
 }
 
 /**
@@ -1,11 +1,63 @@
+#Runs encrypt over the sample files in every mode and compares with the expected outputs. Exits non-zero if any run
+#fails or any output differs.
+failed=0
+
 echo "Running input file 1"
-./encrypt infile1 outfile1test
+./encrypt -s 10 infile1 outfile1test || failed=1
 
 echo "Output Difference:"
-diff outfile1 outfile1test
+diff outfile1 outfile1test || failed=1
 
 echo "Running input file 2"
-./encrypt infile2 outfile2test
+./encrypt -s 10 infile2 outfile2test || failed=1
+
+echo "Output Difference:"
+diff outfile2 outfile2test || failed=1
+
+echo "Running input file 1 fused"
+./encrypt --fused infile1 outfile1test || failed=1
 
 echo "Output Difference:"
-diff outfile2 outfile2test
+diff outfile1 outfile1test || failed=1
+
+echo "Running input file 1 with pinned stages"
+./encrypt -s 10 --pin auto infile1 outfile1test || failed=1
+
+echo "Output Difference:"
+diff outfile1 outfile1test || failed=1
+
+echo "Running both input files as a batch"
+printf "infile1\ninfile2\n" > batchtest
+./encrypt --batch -t 2 batchtest batchtestout || failed=1
+
+echo "Output Difference:"
+diff outfile1 batchtestout/infile1 || failed=1
+diff outfile2 batchtestout/infile2 || failed=1
+rm -rf batchtest batchtestout
+
+echo "Running input file 2 through a pipe"
+cat infile2 | ./encrypt - - 2> /dev/null > outfile2test || failed=1
+
+echo "Output Difference:"
+diff outfile2 outfile2test || failed=1
+
+echo "Decrypting output file 1"
+./encrypt -s 10 --decrypt outfile1 outfile1test || failed=1
+
+echo "Output Difference:"
+diff infile1 outfile1test || failed=1
+
+echo "Running input file 1 through the daemon"
+./encrypt --serve /tmp/encryptTest.sock 2> /dev/null &
+sleep 1
+./encryptClient --socket /tmp/encryptTest.sock infile1 outfile1test > /dev/null || failed=1
+kill $!
+
+echo "Output Difference:"
+diff outfile1 outfile1test || failed=1
+
+if [ $failed -ne 0 ]; then
+	echo "FAILED"
+fi
+
+exit $failed
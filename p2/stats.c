@@ -0,0 +1,115 @@
+/**
+	Per-stage instrumentation for the encrypt pipeline: counters, blocked time and queue occupancy, reported as JSON or CSV
+	at exit and optionally sampled periodically.
+*/
+
+//CLib imports
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+
+//Wait on a semaphore, timing the wait only if it actually blocks
+void stageWait(stageStats* stage, sem_t* sem){
+	struct timespec start, end;
+	
+	if ( sem_trywait(sem) == 0 ) {
+		return;
+	}
+	
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	sem_wait(sem);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	
+	atomic_fetch_add_explicit(&stage->waits, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&stage->waitNs, (end.tv_sec - start.tv_sec) * 1000000000LL + (end.tv_nsec - start.tv_nsec), memory_order_relaxed);
+}
+
+//Record a processed block
+void stageDone(stageStats* stage, int bytes){
+	atomic_fetch_add_explicit(&stage->bytes, bytes, memory_order_relaxed);
+	atomic_fetch_add_explicit(&stage->blocks, 1, memory_order_relaxed);
+}
+
+//Record how many blocks a queue holds after an enqueue
+void queueOccupancy(queueStats* queue, unsigned int count){
+	if ( count >= OCCUPANCY_BUCKETS ) {
+		count = OCCUPANCY_BUCKETS - 1;
+	}
+	
+	atomic_fetch_add_explicit(&queue->samples[count], 1, memory_order_relaxed);
+}
+
+//One line snapshot for periodic sampling: throughput and blocked time per stage, current queue occupancy
+void statsSample(FILE* out, double elapsedMs, stageStats* stages, int stageCount, int* occupancy, queueStats* queues, int queueCount){
+	int i;
+	
+	fprintf(out, "[%.0f ms]", elapsedMs);
+	
+	for(i = 0; i < stageCount; i++ ) {
+		fprintf(out, " %s %.1f MB/s %.0f ms blocked,", stages[i].name,
+			atomic_load(&stages[i].bytes) / (elapsedMs * 1000.0),
+			atomic_load(&stages[i].waitNs) / 1000000.0);
+	}
+	
+	for(i = 0; i < queueCount; i++ ) {
+		fprintf(out, " %s queue %d", queues[i].name, occupancy[i]);
+	}
+	
+	fprintf(out, "\n");
+	fflush(out);
+}
+
+//Full summary at exit, as "json" or "csv"
+void statsReport(FILE* out, const char* format, double elapsedMs, stageStats* stages, int stageCount, queueStats* queues, int queueCount){
+	int i, j;
+	int json = strcmp(format, "json") == 0;
+	
+	if ( json ) {
+		fprintf(out, "{\"wall_ms\": %.3f, \"stages\": [", elapsedMs);
+		
+		for(i = 0; i < stageCount; i++ ) {
+			fprintf(out, "%s{\"name\": \"%s\", \"bytes\": %lld, \"blocks\": %lld, \"waits\": %lld, \"wait_ms\": %.3f, \"mb_per_s\": %.3f}",
+				i ? ", " : "", stages[i].name, atomic_load(&stages[i].bytes), atomic_load(&stages[i].blocks),
+				atomic_load(&stages[i].waits), atomic_load(&stages[i].waitNs) / 1000000.0,
+				elapsedMs > 0 ? atomic_load(&stages[i].bytes) / (elapsedMs * 1000.0) : 0.0);
+		}
+		
+		fprintf(out, "], \"queues\": [");
+		
+		for(i = 0; i < queueCount; i++ ) {
+			fprintf(out, "%s{\"name\": \"%s\", \"occupancy\": [", i ? ", " : "", queues[i].name);
+			
+			for(j = 0; j < OCCUPANCY_BUCKETS; j++ ) {
+				fprintf(out, "%s%lld", j ? ", " : "", atomic_load(&queues[i].samples[j]));
+			}
+			
+			fprintf(out, "]}");
+		}
+		
+		fprintf(out, "]}\n");
+	} else {
+		fprintf(out, "stage,bytes,blocks,waits,wait_ms,mb_per_s\n");
+		
+		for(i = 0; i < stageCount; i++ ) {
+			fprintf(out, "%s,%lld,%lld,%lld,%.3f,%.3f\n", stages[i].name, atomic_load(&stages[i].bytes),
+				atomic_load(&stages[i].blocks), atomic_load(&stages[i].waits), atomic_load(&stages[i].waitNs) / 1000000.0,
+				elapsedMs > 0 ? atomic_load(&stages[i].bytes) / (elapsedMs * 1000.0) : 0.0);
+		}
+		
+		fprintf(out, "queue,occupancy,samples\n");
+		
+		for(i = 0; i < queueCount; i++ ) {
+			for(j = 0; j < OCCUPANCY_BUCKETS; j++ ) {
+				if ( atomic_load(&queues[i].samples[j]) > 0 ) {
+					fprintf(out, "%s,%d,%lld\n", queues[i].name, j, atomic_load(&queues[i].samples[j]));
+				}
+			}
+		}
+		
+		fprintf(out, "wall_ms,%.3f\n", elapsedMs);
+	}
+	
+	fflush(out);
+}
@@ -0,0 +1,41 @@
+/**
+	Per-stage instrumentation for the encrypt pipeline.
+	
+	Every stage counts the bytes and blocks it has processed and the time it spent blocked waiting on its semaphores, and
+	every buffer queue keeps a histogram of how full it was each time a block was added. The counters are only written by
+	the thread that owns them, so they cost a relaxed atomic add per block.
+*/
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdatomic.h>
+#include <semaphore.h>
+
+//Occupancies at or above the last bucket share it
+#define OCCUPANCY_BUCKETS 65
+
+//Counters for one pipeline stage
+typedef struct {
+	_Alignas(64) const char* name;
+	atomic_llong bytes; //Bytes processed
+	atomic_llong blocks; //Blocks processed
+	atomic_llong waits; //Times the stage had to block
+	atomic_llong waitNs; //Time spent blocked
+} stageStats;
+
+//Occupancy histogram for one buffer queue
+typedef struct {
+	_Alignas(64) const char* name;
+	atomic_llong samples[OCCUPANCY_BUCKETS]; //Number of enqueues that left the queue holding each number of blocks
+} queueStats;
+
+void stageWait(stageStats* stage, sem_t* sem);
+void stageDone(stageStats* stage, int bytes);
+void queueOccupancy(queueStats* queue, unsigned int count);
+
+void statsSample(FILE* out, double elapsedMs, stageStats* stages, int stageCount, int* occupancy, queueStats* queues, int queueCount);
+void statsReport(FILE* out, const char* format, double elapsedMs, stageStats* stages, int stageCount, queueStats* queues, int queueCount);
+
+#endif